@@ -529,11 +529,38 @@ void m68k_init(m68k_context *m68k)
 		build_opcode_table();
 
 	memset(m68k->reg, 0, sizeof(m68k->reg));
+	m68k->cycles = 0;
 	FETCH_OPCODE;
 }
 
 void m68k_update(m68k_context *m68k)
 {
+	++m68k->cycles;
 	if (!(--m68k->timeout))
 		m68k->next_func(m68k);
 }
+
+uint32_t m68k_run(m68k_context *m68k, uint32_t cycles)
+{
+	return (uint32_t)m68k_run_until(m68k, m68k->cycles + cycles);
+}
+
+uint64_t m68k_run_until(m68k_context *m68k, uint64_t target)
+{
+	uint64_t start = m68k->cycles;
+
+	if (target <= start)
+		return 0;
+
+	// jump from one continuation to another while they fit into target
+	while (m68k->cycles + m68k->timeout <= target)
+	{
+		m68k->cycles += m68k->timeout;
+		m68k->next_func(m68k);
+	}
+
+	// rest of cycles are partially consumed by pending continuation
+	m68k->timeout -= (uint32_t)(target - m68k->cycles);
+	m68k->cycles = target;
+	return target - start;
+}
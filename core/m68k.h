@@ -62,6 +62,7 @@
 #define M68K_FLAG_I1_MASK (1<<9)
 #define M68K_FLAG_I2_BIT 10 // interupt priority bit 2
 #define M68K_FLAG_I2_MASK (1<<10)
+#define M68K_FLAG_I_MASK (M68K_FLAG_I0_MASK|M68K_FLAG_I1_MASK|M68K_FLAG_I2_MASK)
 
 // master/interrupt state (not used in M68000)
 //#define M68K_FLAG_M_BIT 12
@@ -80,20 +81,115 @@
 // T-S--III---XNZVC
 #define M68K_FLAG_ALL 0xA71F
 
+#define M68K_MODE_CYCLE 0 // every bus access is separate state
+#define M68K_MODE_FAST  1 // whole instruction in one call, no bus-phase accuracy
+#define M68K_MODE_JIT   2 // same as fast but translated blocks, see m68k_jit_enable
+#define M68K_MODE_HYBRID 3 // fast except accesses to exact regions, see m68k_hybrid_enable
+
+#define M68K_MAX_EXT_WORDS 4 // extension words of longest instruction
+
 typedef struct m68k_context_ m68k_context;
+typedef struct m68k_cache_ m68k_cache;
+typedef struct m68k_jit_ m68k_jit;
+typedef struct m68k_rec_ m68k_rec;
+typedef struct m68k_idle_ m68k_idle;
+typedef struct m68k_loop_ m68k_loop;
+typedef struct m68k_hybrid_ m68k_hybrid;
+typedef struct m68k_profile_ m68k_profile;
 
 #define M68K_FUNCTION(name) extern void name(m68k_context* m68k)
 typedef void (*m68k_function)(m68k_context* m68k);
+#define M68K_FAST_FUNCTION(name) extern uint32_t name(m68k_context* m68k)
+typedef uint32_t (*m68k_fast_function)(m68k_context* m68k); // returns cycles or 0 if next_func is set
+#ifdef __GNUC__
+#define M68K_HOT __attribute__((hot)) // handler of opcode hot in profile
+#define M68K_COLD __attribute__((cold)) // exception or never executed handler
+#else
+#define M68K_HOT
+#define M68K_COLD
+#endif
+typedef struct m68k_cont_ m68k_cont;
+#define M68K_CONT_FUNCTION(name) extern m68k_cont name(m68k_context* m68k)
+typedef m68k_cont (*m68k_cont_function)(m68k_context* m68k);
 typedef uint32_t (*m68k_read_handler)(m68k_context* m68k, uint32_t address);
 typedef void (*m68k_write_handler)(m68k_context* m68k, uint32_t address, uint32_t value);
 
+// moves count words starting at address in one call, used by MOVEM of fast
+// core, words are in address order. returns 0 if range isn't plain memory without side effects,
+// then words go through read_w/write_w one by one
+typedef int (*m68k_block_handler)(m68k_context* m68k, uint32_t address, uint16_t *words, uint32_t count);
+
+// 64 KB page of 24 bit address space accessed by generated handlers without
+// callbacks, read_w/write_b/write_w still must handle whole address space,
+// since cache, idle and hybrid watch accesses through them
+#define M68K_PAGE_COUNT 256
+#define M68K_PAGE_READ  1 // reads come from mem, use for ROM and RAM
+#define M68K_PAGE_WRITE 2 // writes go to mem, use for RAM
+typedef struct m68k_page_
+{
+	uint8_t *mem;   // 64 KB, big endian words
+	uint32_t flags; // M68K_PAGE_*, 0 for I/O and unmapped pages
+} m68k_page;
+
+// block of ROM translated ahead of time by "m68kgen fast rom.bin"
+typedef struct m68k_rec_block_
+{
+	uint32_t pc;
+	m68k_fast_function run; // same convention as fast handler
+} m68k_rec_block;
+
+// what opcode does without running it, written by "m68kgen fast" into
+// m68k_opcode_info.c. EA modes are 0 Dn, 1 An, 2 (An), 3 (An)+, 4 -(An),
+// 5 (d16,An), 6 (d8,An,Xn), 7 (xxx).W, 8 (xxx).L, 9 (d16,PC), 10 (d8,PC,Xn),
+// 11 #<data>, flags are M68K_FLAG_*_MASK of CCR
+#define M68K_EA_NONE 0xFF
+typedef struct m68k_opcode_info_
+{
+	uint8_t length;  // words including opcode, 0 if opcode is invalid
+	uint8_t cycles;  // charged by fast core, operand dependent time of
+	                 // multiply, divide, shift by Dn and MOVEM is not included
+	uint8_t reads;   // data words read, instruction stream excluded,
+	uint8_t writes;  // data words written, both 0 for MOVEM
+	uint8_t size;    // of EA operand, 0 byte, 1 word, 2 long, 3 none
+	uint8_t ea;      // mode of EA field, source one of move
+	uint8_t ea_dest; // destination mode of move
+	uint8_t flags_read;
+	uint8_t flags_written;
+} m68k_opcode_info;
+
+// continuation returned in registers by handlers of "m68kgen cont" core
+struct m68k_cont_
+{
+	m68k_cont_function next;
+	uint32_t timeout;
+};
+
 struct m68k_context_
 {
 	uint32_t reg[M68K_REG_COUNT];
-	uint32_t timeout;
+	uint32_t timeout; // cycles left until next_func is called
+	uint64_t cycles;  // absolute cycle counter
+	uint32_t mode;    // M68K_MODE_*, set after m68k_init
+	uint32_t state;   // next state of threaded core
+	uint32_t stopped; // STOP is executed, waits for m68k_interrupt
+
+	// NZVC not yet stored into SR, see M68K_LAZY_FLAGS in m68k_opcode.h
+	// SR is up to date whenever run functions return
+	uint32_t flag_kind;
+	uint32_t flag_src, flag_dest, flag_res;
+	m68k_cont_function cont_func; // next state of continuation core, 0 to start from state
 	m68k_function next_func,fetch_ret,effective_ret;
 	m68k_read_handler read_w;
 	m68k_write_handler write_b, write_w;
+	m68k_block_handler read_block, write_block; // optional, may be 0
+	m68k_page *pages; // optional M68K_PAGE_COUNT pages, may be 0
+	m68k_cache *cache; // block cache of fast core, see m68k_cache_enable
+	m68k_jit *jit;     // translated blocks, see m68k_jit_enable
+	m68k_rec *rec;     // ROM blocks translated ahead of time, see m68k_rec_enable
+	m68k_idle *idle;   // polling loop skipping, see m68k_idle_enable
+	m68k_loop *loop;   // bulk fill/copy loops, see m68k_loop_enable
+	m68k_hybrid *hybrid; // accuracy of memory regions, see m68k_hybrid_enable
+	m68k_profile *profile; // opcode counters, see m68k_profile_enable
 
 	// current operation data
 	uint32_t opcode;
@@ -103,10 +199,96 @@ struct m68k_context_
 	uint32_t effective_address;
 	uint32_t operand;
 	uint32_t operand2;
+
+	// extension words of current instruction in fast core
+	const uint16_t *ext;
+	uint16_t ext_words[M68K_MAX_EXT_WORDS];
 };
 
 void m68k_init(m68k_context *m68k);
 
+// interrupt of given level (1-7) with autovector arrives at m68k->cycles
+// only stopped CPU takes it so far, returns 0 if it's not stopped or level
+// is masked, so level should be kept pending
+int m68k_interrupt(m68k_context *m68k, uint32_t level);
+
+// advance by one cycle
 void m68k_update(m68k_context *m68k);
 
+// advance by given amount of cycles, returns amount of cycles passed
+uint32_t m68k_run(m68k_context *m68k, uint32_t cycles);
+
+// advance until m68k->cycles reaches target, returns amount of cycles passed
+uint64_t m68k_run_until(m68k_context *m68k, uint64_t target);
+
+// same as m68k_run_until but for threaded core (m68kgen threaded)
+// must be used for context since m68k_init
+uint64_t m68k_threaded_run_until(m68k_context *m68k, uint64_t target);
+
+// same as m68k_run_until but for continuation core (m68kgen cont)
+// must be used for context since m68k_init
+uint64_t m68k_cont_run_until(m68k_context *m68k, uint64_t target);
+
+// pre-decoded blocks keyed by PC for M68K_MODE_FAST
+// must be enabled after read_w/write_b/write_w/write_block/pages are set, writes
+// to pages holding cached code drop affected blocks, so writes of mapped pages go
+// through write_b/write_w while cache is enabled. returns 0 if out of memory
+int m68k_cache_enable(m68k_context *m68k);
+void m68k_cache_disable(m68k_context *m68k);
+
+// drop all blocks, needed if code memory is changed bypassing write_*
+void m68k_cache_flush(m68k_context *m68k);
+
+// x86-64 translation of cached blocks for M68K_MODE_JIT, enables cache
+// if perf_map is set, blocks are listed in /tmp/perf-<pid>.map
+// returns 0 if not supported on this host
+int m68k_jit_enable(m68k_context *m68k, int perf_map);
+void m68k_jit_disable(m68k_context *m68k);
+
+// use ahead of time translated blocks in M68K_MODE_FAST
+// blocks are m68k_rec_blocks and m68k_rec_block_count of m68k_rec_blocks.c
+// code outside of them runs in fast core, returns 0 if out of memory
+int m68k_rec_enable(m68k_context *m68k, const m68k_rec_block *blocks, uint32_t count);
+void m68k_rec_disable(m68k_context *m68k);
+
+// skip iterations of polling loops without side effects in fast modes
+// reads from [start, end) must not change during m68k_run_until other than
+// by CPU itself, e.g. work RAM. returns 0 if out of memory
+int m68k_idle_enable(m68k_context *m68k, uint32_t start, uint32_t end);
+void m68k_idle_disable(m68k_context *m68k);
+
+// run dbf loops filling or copying [start, end) in fast modes on host
+// memory, which holds that range big endian and isn't I/O. loops touching
+// anything else run as usual. returns 0 if out of memory
+int m68k_loop_enable(m68k_context *m68k, uint32_t start, uint32_t end, uint8_t *memory);
+void m68k_loop_disable(m68k_context *m68k);
+
+// per region accuracy for M68K_MODE_HYBRID, whole memory is exact until
+// regions without timing-sensitive hardware (ROM, work RAM) are marked
+// relaxed. instruction touching only relaxed regions runs as one step,
+// others run cycle-split. idle and fill/copy loops are not skipped in
+// this mode. returns 0 if out of memory
+int m68k_hybrid_enable(m68k_context *m68k);
+void m68k_hybrid_disable(m68k_context *m68k);
+
+// sets accuracy of [start, end), 256 byte granularity, reads from relaxed
+// region must have no side effects
+void m68k_hybrid_region(m68k_context *m68k, uint32_t start, uint32_t end, int exact);
+
+// count executed opcodes for "m68kgen profile=file" in m68k_run_until of
+// M68K_MODE_CYCLE and M68K_MODE_FAST, second opcodes of fused pairs included.
+// threaded and continuation cores don't count. returns 0 if out of memory or
+// if cache, JIT, ROM blocks or hybrid mode is enabled, they skip counting.
+// iterations skipped by idle and fill/copy loops are not counted either
+int m68k_profile_enable(m68k_context *m68k);
+void m68k_profile_disable(m68k_context *m68k);
+
+// writes "opcode count" lines, returns 0 if not enabled or can't write
+int m68k_profile_save(m68k_context *m68k, const char *name);
+
+// metadata of opcode from m68k_opcode_info.c, opcodes share rows of table
+extern const m68k_opcode_info m68k_opcode_info_table[];
+extern const uint16_t m68k_opcode_info_index[0x10000];
+#define M68K_OPCODE_INFO(opcode) (&m68k_opcode_info_table[m68k_opcode_info_index[(opcode) & 0xFFFF]])
+
 #endif
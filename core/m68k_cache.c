@@ -0,0 +1,285 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Block cache of fast core.
+// Block is straight-line run of pre-decoded instructions starting at PC.
+// Instructions are run one by one while PC follows the block, so taken
+// branches simply continue in another block.
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+#include "m68k_cache.h"
+
+#include <stdlib.h>
+
+#define M68K_CACHE_BLOCKS 1024 // must be power of 2
+#define M68K_CACHE_PAGE_BITS 10
+#define M68K_CACHE_PAGES (1<<(24-M68K_CACHE_PAGE_BITS))
+
+#define ADDRESS_MASK 0xFFFFFF
+
+struct m68k_cache_
+{
+	m68k_cache_block block[M68K_CACHE_BLOCKS];
+	const m68k_cache_block *current; // block which is running now
+	uint32_t index;                  // next instruction of current block
+	uint8_t code[M68K_CACHE_PAGES]; // page holds cached instructions
+	m68k_write_handler write_b, write_w; // original handlers
+	m68k_block_handler write_block;
+	m68k_page *pages; // original pages, writes are dropped from read_pages
+	m68k_page read_pages[M68K_PAGE_COUNT];
+};
+
+static void cache_invalidate(m68k_context *m68k, uint32_t address)
+{
+	m68k_cache *cache = m68k->cache;
+	uint32_t page = (address & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS;
+	uint32_t first, last;
+	int i;
+
+	for (i=0; i<M68K_CACHE_BLOCKS; ++i)
+	{
+		m68k_cache_block *block = &cache->block[i];
+		if (block->pc == M68K_CACHE_FREE)
+			continue;
+
+		first = (block->pc & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS;
+		last = ((block->end - 1) & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS;
+		if (first <= page && page <= last)
+			block->pc = M68K_CACHE_FREE;
+	}
+	cache->code[page] = 0;
+	cache->current = 0;
+
+	// translated code may be chained to any block
+	if (m68k->jit)
+		m68k_jit_flush(m68k);
+}
+
+void m68k_cache_invalidate(m68k_context *m68k, uint32_t start, uint32_t end)
+{
+	m68k_cache *cache = m68k->cache;
+	uint32_t address;
+
+	for (address = start & ~((1<<M68K_CACHE_PAGE_BITS) - 1); address < end; address += 1<<M68K_CACHE_PAGE_BITS)
+		if (cache->code[(address & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS])
+			cache_invalidate(m68k, address);
+}
+
+static void cache_write_b(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_cache *cache = m68k->cache;
+
+	if (cache->code[(address & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS])
+		cache_invalidate(m68k, address);
+	cache->write_b(m68k, address, value);
+}
+
+static void cache_write_w(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_cache *cache = m68k->cache;
+
+	if (cache->code[(address & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS])
+		cache_invalidate(m68k, address);
+	cache->write_w(m68k, address, value);
+}
+
+static int cache_write_block(m68k_context *m68k, uint32_t address, uint16_t *words, uint32_t count)
+{
+	if (!m68k->cache->write_block(m68k, address, words, count))
+		return 0;
+	m68k_cache_invalidate(m68k, address, address + count*2);
+	return 1;
+}
+
+// upper bound of cycles of flag writer or keeper, shift by Dn takes 2 more
+// for each bit of count, which is up to 63
+static uint32_t cache_max_cycles(uint32_t opcode)
+{
+	uint32_t cycles = M68K_OPCODE_INFO(opcode)->cycles;
+
+	if ((opcode & 0xF020) == 0xE020 && (opcode & 0xC0) != 0xC0)
+		cycles += 2 + 2*63;
+	return cycles;
+}
+
+static void cache_build(m68k_context *m68k, m68k_cache_block *block, uint32_t pc)
+{
+	m68k_cache *cache = m68k->cache;
+	uint32_t i, length, live, keep;
+
+	block->pc = pc;
+	block->count = 0;
+	while (block->count < M68K_CACHE_BLOCK_LENGTH)
+	{
+		m68k_cache_entry *entry = &block->entry[block->count++];
+
+		entry->pc = pc;
+		entry->opcode = READ_16(pc);
+		entry->handler = M68K_FAST_HANDLER(entry->opcode);
+		entry->nf_handler = 0;
+		length = m68k_fast_opcode_length[entry->opcode];
+		entry->length = length;
+		for (i=1; i<length; ++i)
+			entry->ext[i-1] = READ_16(pc + i*2);
+
+		cache->code[(pc & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS] = 1;
+		pc += length*2;
+		cache->code[((pc - 1) & ADDRESS_MASK) >> M68K_CACHE_PAGE_BITS] = 1;
+
+		// anything after invalid opcode is most likely data
+		if (entry->handler == fast_invalid)
+			break;
+	}
+	block->end = pc;
+
+	// flags overwritten before use are not computed, flags are live
+	// at block end since next block is unknown. time of writers and keepers
+	// is known up to shift count, which tells if run slice may end before
+	// next writer
+	live = 1;
+	keep = 0;
+	for (i=block->count; i--; )
+	{
+		m68k_cache_entry *entry = &block->entry[i];
+
+		switch (m68k_fast_opcode_flags[entry->opcode])
+		{
+			case M68K_FAST_FLAGS_WRITE:
+				if (!live)
+				{
+					entry->nf_handler = M68K_FAST_NF_HANDLER(entry->opcode);
+					entry->nf_cycles = cache_max_cycles(entry->opcode) + keep;
+				}
+				live = 0;
+				keep = 0;
+				break;
+			case M68K_FAST_FLAGS_KEEP:
+				keep += cache_max_cycles(entry->opcode);
+				break;
+			default:
+				live = 1;
+				break;
+		}
+	}
+}
+
+const m68k_cache_block* m68k_cache_block_at(m68k_context *m68k, uint32_t pc)
+{
+	m68k_cache_block *block = &m68k->cache->block[(pc >> 1) & (M68K_CACHE_BLOCKS - 1)];
+
+	if (block->pc != pc)
+		cache_build(m68k, block, pc);
+	return block;
+}
+
+uint32_t m68k_cache_execute(m68k_context *m68k, uint32_t budget)
+{
+	m68k_cache *cache = m68k->cache;
+	const m68k_cache_block *block = cache->current;
+	const m68k_cache_entry *entry;
+
+	if (!block
+	 || cache->index >= block->count
+	 || block->entry[cache->index].pc != PC)
+	{
+		block = m68k_cache_block_at(m68k, PC);
+		cache->current = block;
+		cache->index = 0;
+	}
+
+	entry = &block->entry[cache->index++];
+	m68k->opcode = entry->opcode;
+	m68k->ext = entry->ext;
+	PC += 2;
+
+	// SR must be up to date if run slice ends before next flag writer
+	if (entry->nf_handler && entry->nf_cycles <= budget)
+		return entry->nf_handler(m68k);
+	return entry->handler(m68k);
+}
+
+void m68k_cache_flush(m68k_context *m68k)
+{
+	m68k_cache *cache = m68k->cache;
+	int i;
+
+	if (!cache)
+		return;
+
+	for (i=0; i<M68K_CACHE_BLOCKS; ++i)
+		cache->block[i].pc = M68K_CACHE_FREE;
+	for (i=0; i<M68K_CACHE_PAGES; ++i)
+		cache->code[i] = 0;
+	cache->current = 0;
+
+	if (m68k->jit)
+		m68k_jit_flush(m68k);
+}
+
+int m68k_cache_enable(m68k_context *m68k)
+{
+	m68k_cache *cache;
+	int i;
+
+	if (m68k->cache)
+		return 1;
+
+	cache = (m68k_cache*)malloc(sizeof(m68k_cache));
+	if (!cache)
+		return 0;
+
+	cache->write_b = m68k->write_b;
+	cache->write_w = m68k->write_w;
+	cache->write_block = m68k->write_block;
+	m68k->write_b = cache_write_b;
+	m68k->write_w = cache_write_w;
+	if (m68k->write_block)
+		m68k->write_block = cache_write_block;
+	cache->pages = m68k->pages;
+	if (m68k->pages)
+	{
+		for (i=0; i<M68K_PAGE_COUNT; ++i)
+		{
+			cache->read_pages[i] = m68k->pages[i];
+			cache->read_pages[i].flags &= ~M68K_PAGE_WRITE;
+		}
+		m68k->pages = cache->read_pages;
+	}
+	m68k->cache = cache;
+	m68k_cache_flush(m68k);
+	return 1;
+}
+
+void m68k_cache_disable(m68k_context *m68k)
+{
+	m68k_cache *cache = m68k->cache;
+
+	if (!cache)
+		return;
+
+	// translated code relies on invalidation by cache
+	m68k_jit_disable(m68k);
+
+	m68k->write_b = cache->write_b;
+	m68k->write_w = cache->write_w;
+	m68k->write_block = cache->write_block;
+	m68k->pages = cache->pages;
+	m68k->cache = 0;
+	free(cache);
+}
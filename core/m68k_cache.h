@@ -0,0 +1,55 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef M68K_CACHE_H
+#define M68K_CACHE_H
+#pragma once
+
+#include "m68k.h"
+
+#define M68K_CACHE_BLOCK_LENGTH 16 // instructions per block
+#define M68K_CACHE_FREE 0xFFFFFFFF
+
+typedef struct m68k_cache_entry_
+{
+	m68k_fast_function handler;
+	m68k_fast_function nf_handler; // flags-dead variant or 0
+	uint32_t pc;
+	uint16_t opcode;
+	uint16_t length; // in words, opcode included
+	uint16_t nf_cycles; // of it and instructions until next flag writer
+	uint16_t ext[M68K_MAX_EXT_WORDS];
+} m68k_cache_entry;
+
+typedef struct m68k_cache_block_
+{
+	uint32_t pc;    // address of first instruction or M68K_CACHE_FREE
+	uint32_t end;   // address after last instruction
+	uint32_t count; // amount of instructions
+	m68k_cache_entry entry[M68K_CACHE_BLOCK_LENGTH];
+} m68k_cache_block;
+
+// decoded block at pc, valid until next write to code or next call
+const m68k_cache_block* m68k_cache_block_at(m68k_context *m68k, uint32_t pc);
+
+// drop blocks from [start, end) written bypassing write_*
+void m68k_cache_invalidate(m68k_context *m68k, uint32_t start, uint32_t end);
+
+// drop all translated code, called on any code invalidation
+void m68k_jit_flush(m68k_context *m68k);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Hybrid accuracy of M68K_MODE_HYBRID.
+// Instruction is run by fast handler with every access checked. First
+// access to exact page is not done, instruction is rolled back and run
+// again by cycle-split states, so bus timing of I/O stays exact while
+// code touching only relaxed memory runs in one step.
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define M68K_HYBRID_PAGE_BITS 8
+#define M68K_HYBRID_PAGES (1<<(24-M68K_HYBRID_PAGE_BITS))
+#define M68K_HYBRID_EXACT_PCS 256 // must be power of 2
+#define M68K_HYBRID_UNDO 64 // words written by instruction and its exception
+
+#define ADDRESS_MASK 0xFFFFFF
+#define PAGE(address) (((address) & ADDRESS_MASK) >> M68K_HYBRID_PAGE_BITS)
+
+typedef struct
+{
+	uint32_t address;
+	uint32_t value;
+} m68k_hybrid_undo;
+
+struct m68k_hybrid_
+{
+	uint8_t relaxed[M68K_HYBRID_PAGES];
+	uint32_t exact_pc[M68K_HYBRID_EXACT_PCS]; // instructions which touched exact page
+	uint32_t abort; // exact page is hit, rest of accesses are dropped
+	uint32_t undo_count;
+	m68k_hybrid_undo undo[M68K_HYBRID_UNDO];
+
+	// handlers replaced while instruction runs
+	m68k_read_handler read_w;
+	m68k_write_handler write_b, write_w;
+	m68k_block_handler read_block, write_block; // off, MOVEM goes word by word
+	m68k_page *pages; // off, mapped pages go through handlers too
+};
+
+static uint32_t hybrid_read_w(m68k_context *m68k, uint32_t address)
+{
+	m68k_hybrid *hybrid = m68k->hybrid;
+
+	if (hybrid->abort || !hybrid->relaxed[PAGE(address)])
+	{
+		hybrid->abort = 1;
+		return 0;
+	}
+	return hybrid->read_w(m68k, address);
+}
+
+// old word is kept, relaxed memory is read without side effects
+static int hybrid_log(m68k_hybrid *hybrid, m68k_context *m68k, uint32_t address)
+{
+	m68k_hybrid_undo *undo;
+
+	if (hybrid->abort
+	 || !hybrid->relaxed[PAGE(address)]
+	 || hybrid->undo_count == M68K_HYBRID_UNDO)
+	{
+		hybrid->abort = 1;
+		return 0;
+	}
+
+	undo = &hybrid->undo[hybrid->undo_count++];
+	undo->address = address & ~1;
+	undo->value = hybrid->read_w(m68k, undo->address);
+	return 1;
+}
+
+static void hybrid_write_b(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_hybrid *hybrid = m68k->hybrid;
+
+	if (hybrid_log(hybrid, m68k, address))
+		hybrid->write_b(m68k, address, value);
+}
+
+static void hybrid_write_w(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_hybrid *hybrid = m68k->hybrid;
+
+	if (hybrid_log(hybrid, m68k, address))
+		hybrid->write_w(m68k, address, value);
+}
+
+uint32_t m68k_hybrid_execute(m68k_context *m68k)
+{
+	m68k_hybrid *hybrid = m68k->hybrid;
+	uint32_t *exact_pc = &hybrid->exact_pc[(PC >> 1) & (M68K_HYBRID_EXACT_PCS - 1)];
+	uint32_t reg[M68K_REG_COUNT];
+	uint32_t flag_kind, flag_src, flag_dest, flag_res;
+	uint32_t time, i, length;
+
+	// code in exact region always runs cycle-split
+	if (*exact_pc == PC || !hybrid->relaxed[PAGE(PC)])
+	{
+		opcode_read(m68k);
+		return 0;
+	}
+	m68k->opcode = READ_16(PC);
+	length = m68k_fast_opcode_length[m68k->opcode];
+	if (!hybrid->relaxed[PAGE(PC + length*2 - 1)])
+	{
+		opcode_read(m68k);
+		return 0;
+	}
+	for (i=1; i<length; ++i)
+		m68k->ext_words[i-1] = READ_16(PC + i*2);
+	m68k->ext = m68k->ext_words;
+
+	// fast handler changes only registers and pending flags, or state of
+	// exception which is set up again by cycle-split states
+	memcpy(reg, m68k->reg, sizeof(reg));
+	flag_kind = m68k->flag_kind;
+	flag_src = m68k->flag_src;
+	flag_dest = m68k->flag_dest;
+	flag_res = m68k->flag_res;
+	hybrid->abort = 0;
+	hybrid->undo_count = 0;
+	hybrid->read_w = m68k->read_w;
+	hybrid->write_b = m68k->write_b;
+	hybrid->write_w = m68k->write_w;
+	hybrid->read_block = m68k->read_block;
+	hybrid->write_block = m68k->write_block;
+	hybrid->pages = m68k->pages;
+	m68k->read_w = hybrid_read_w;
+	m68k->write_b = hybrid_write_b;
+	m68k->write_w = hybrid_write_w;
+	m68k->read_block = 0;
+	m68k->write_block = 0;
+	m68k->pages = 0;
+	PC += 2;
+	time = M68K_FAST_HANDLER(m68k->opcode)(m68k);
+
+	m68k->read_w = hybrid->read_w;
+	m68k->write_b = hybrid->write_b;
+	m68k->write_w = hybrid->write_w;
+	m68k->read_block = hybrid->read_block;
+	m68k->write_block = hybrid->write_block;
+	m68k->pages = hybrid->pages;
+	if (!hybrid->abort)
+		return time;
+
+	// nothing done by instruction is kept, next time it goes cycle-split
+	for (i=hybrid->undo_count; i--; )
+		hybrid->write_w(m68k, hybrid->undo[i].address, hybrid->undo[i].value);
+	memcpy(m68k->reg, reg, sizeof(reg));
+	m68k->flag_kind = flag_kind;
+	m68k->flag_src = flag_src;
+	m68k->flag_dest = flag_dest;
+	m68k->flag_res = flag_res;
+	m68k->stopped = 0;
+	*exact_pc = PC;
+	opcode_read(m68k);
+	return 0;
+}
+
+void m68k_hybrid_region(m68k_context *m68k, uint32_t start, uint32_t end, int exact)
+{
+	m68k_hybrid *hybrid = m68k->hybrid;
+	uint32_t page;
+
+	if (!hybrid || start >= end)
+		return;
+
+	for (page = PAGE(start); page <= PAGE(end - 1); ++page)
+		hybrid->relaxed[page] = !exact;
+	memset(hybrid->exact_pc, 0xFF, sizeof(hybrid->exact_pc));
+}
+
+int m68k_hybrid_enable(m68k_context *m68k)
+{
+	m68k_hybrid *hybrid;
+
+	if (m68k->hybrid)
+		return 1;
+
+	hybrid = (m68k_hybrid*)calloc(1, sizeof(m68k_hybrid));
+	if (!hybrid)
+		return 0;
+
+	memset(hybrid->exact_pc, 0xFF, sizeof(hybrid->exact_pc));
+	m68k->hybrid = hybrid;
+	return 1;
+}
+
+void m68k_hybrid_disable(m68k_context *m68k)
+{
+	free(m68k->hybrid);
+	m68k->hybrid = 0;
+}
@@ -0,0 +1,166 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Fast-forward of polling loops in fast core.
+// Loop is run once more with writes and reads outside of stable region
+// noticed. If it left registers as they were, every next iteration is the
+// same, so all whole iterations fitting into budget are skipped at once.
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define M68K_IDLE_MAX_STEPS 16 // instructions per iteration
+#define M68K_IDLE_RETRY 64     // loops before failed head is tried again
+
+#define ADDRESS_MASK 0xFFFFFF
+
+struct m68k_idle_
+{
+	uint32_t start, end; // reads from here don't change while CPU runs
+	uint32_t pure;       // iteration had no side effects
+	uint32_t fail_pc, retry;
+
+	// handlers replaced while iteration runs
+	m68k_read_handler read_w;
+	m68k_write_handler write_b, write_w;
+	m68k_block_handler read_block, write_block; // off, MOVEM goes word by word
+	m68k_page *pages; // off, mapped pages go through handlers too
+};
+
+static uint32_t idle_read_w(m68k_context *m68k, uint32_t address)
+{
+	m68k_idle *idle = m68k->idle;
+
+	address &= ADDRESS_MASK;
+	if (address < idle->start || address >= idle->end)
+		idle->pure = 0;
+	return idle->read_w(m68k, address);
+}
+
+static void idle_write_b(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k->idle->pure = 0;
+	m68k->idle->write_b(m68k, address, value);
+}
+
+static void idle_write_w(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k->idle->pure = 0;
+	m68k->idle->write_w(m68k, address, value);
+}
+
+uint32_t m68k_idle_skip(m68k_context *m68k, uint32_t cycles, uint32_t budget)
+{
+	m68k_idle *idle = m68k->idle;
+	uint32_t reg[M68K_REG_COUNT];
+	uint32_t head = PC, start = cycles;
+	uint32_t time, i, length, steps;
+
+	if (head == idle->fail_pc && idle->retry)
+	{
+		--idle->retry;
+		return cycles;
+	}
+
+	// pending flags are compared too
+	FLUSH_FLAGS;
+	memcpy(reg, m68k->reg, sizeof(reg));
+	idle->pure = 1;
+	idle->read_w = m68k->read_w;
+	idle->write_b = m68k->write_b;
+	idle->write_w = m68k->write_w;
+	idle->read_block = m68k->read_block;
+	idle->write_block = m68k->write_block;
+	idle->pages = m68k->pages;
+
+	// instructions are fetched by original handler, only data is checked
+	for (steps = 0; steps < M68K_IDLE_MAX_STEPS && cycles < budget; ++steps)
+	{
+		m68k->opcode = READ_16(PC);
+		length = m68k_fast_opcode_length[m68k->opcode];
+		for (i=1; i<length; ++i)
+			m68k->ext_words[i-1] = READ_16(PC + i*2);
+		m68k->ext = m68k->ext_words;
+		PC += 2;
+
+		m68k->read_w = idle_read_w;
+		m68k->write_b = idle_write_b;
+		m68k->write_w = idle_write_w;
+		m68k->read_block = 0;
+		m68k->write_block = 0;
+		m68k->pages = 0;
+		time = M68K_FAST_HANDLER(m68k->opcode)(m68k);
+		m68k->read_w = idle->read_w;
+		m68k->write_b = idle->write_b;
+		m68k->write_w = idle->write_w;
+		m68k->read_block = idle->read_block;
+		m68k->write_block = idle->write_block;
+		m68k->pages = idle->pages;
+
+		if (!time)
+		{
+			m68k->timeout += cycles; // next_func is set by handler
+			return 0;
+		}
+		cycles += time;
+		if (PC == head)
+			break;
+	}
+
+	FLUSH_FLAGS;
+	if (PC != head
+	 || !idle->pure
+	 || memcmp(reg, m68k->reg, sizeof(reg)))
+	{
+		idle->fail_pc = head;
+		idle->retry = M68K_IDLE_RETRY;
+		return cycles;
+	}
+
+	time = cycles - start;
+	if (cycles < budget)
+		cycles += (budget - cycles) / time * time;
+	return cycles;
+}
+
+int m68k_idle_enable(m68k_context *m68k, uint32_t start, uint32_t end)
+{
+	m68k_idle *idle = m68k->idle;
+
+	if (!idle)
+	{
+		idle = (m68k_idle*)calloc(1, sizeof(m68k_idle));
+		if (!idle)
+			return 0;
+	}
+
+	idle->start = start;
+	idle->end = end;
+	idle->retry = 0;
+	m68k->idle = idle;
+	return 1;
+}
+
+void m68k_idle_disable(m68k_context *m68k)
+{
+	free(m68k->idle);
+	m68k->idle = 0;
+}
@@ -0,0 +1,372 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// x86-64 translation of cached blocks.
+// Every instruction of block becomes inline setup of opcode, extension
+// words and PC followed by direct call of its generated fast handler,
+// so semantics and timing are exactly those of m68kgen fast core.
+// Calls, cycle sum and PC checks between instructions are native, and
+// block exit is chained directly to the block which followed it first.
+//
+// Registers inside translated code:
+// rbx - m68k_context, r12d - cycles spent, r13 - m68k_jit
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+#include "m68k_cache.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define M68K_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define M68K_JIT_CODE_SIZE (4<<20)
+#define M68K_JIT_BLOCKS 8192
+#define M68K_JIT_MAP 4096 // must be power of 2
+#define M68K_JIT_BLOCK_CODE (128*M68K_CACHE_BLOCK_LENGTH + 256) // worst case
+
+#define OFFSET_OPCODE offsetof(m68k_context, opcode)
+#define OFFSET_EXT offsetof(m68k_context, ext)
+#define OFFSET_EXT_WORDS offsetof(m68k_context, ext_words)
+#define OFFSET_TIMEOUT offsetof(m68k_context, timeout)
+#define OFFSET_PC (offsetof(m68k_context, reg) + M68K_REG_PC*sizeof(uint32_t))
+
+typedef struct m68k_jit_block_
+{
+	uint32_t pc;
+	uint32_t linked;   // successor is patched in
+	uint8_t *code;     // entry point, m68k_fast_function
+	uint8_t *body;     // target of chained jumps, after prologue
+	uint8_t *slot_pc;  // imm32 of successor check
+	uint8_t *slot_jmp; // rel32 of jump to successor
+} m68k_jit_block;
+
+struct m68k_jit_
+{
+	// used by translated code, must be first
+	uint32_t budget;      // chaining stops when this is spent
+	m68k_jit_block *last; // block whose exit was taken last
+
+	uint8_t *code;
+	uint32_t used;
+	uint32_t count;
+	uint32_t generation; // incremented on flush
+	FILE *perf_map;
+	m68k_jit_block block[M68K_JIT_BLOCKS];
+	m68k_jit_block *map[M68K_JIT_MAP];
+};
+
+#define EMIT_PTR (jit->code + jit->used)
+
+static void emit8(m68k_jit *jit, uint32_t v)
+{
+	jit->code[jit->used++] = (uint8_t)v;
+}
+
+static void emit16(m68k_jit *jit, uint32_t v)
+{
+	emit8(jit, v);
+	emit8(jit, v>>8);
+}
+
+static void emit32(m68k_jit *jit, uint32_t v)
+{
+	emit16(jit, v);
+	emit16(jit, v>>16);
+}
+
+static void emit64(m68k_jit *jit, uint64_t v)
+{
+	emit32(jit, (uint32_t)v);
+	emit32(jit, (uint32_t)(v>>32));
+}
+
+// returns position of rel32 to be fixed by emit_fix
+static uint8_t* emit_jcc(m68k_jit *jit, uint32_t cc)
+{
+	emit8(jit, 0x0F);
+	emit8(jit, 0x80 | cc);
+	emit32(jit, 0);
+	return EMIT_PTR - 4;
+}
+
+static void emit_fix(uint8_t *rel, uint8_t *target)
+{
+	uint32_t v = (uint32_t)(target - (rel + 4));
+	memcpy(rel, &v, 4);
+}
+
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_AE 0x3
+
+// raw instruction bytes, "str" must be literal
+#define EMIT(str) emit_bytes(jit, str, sizeof(str) - 1)
+
+static void emit_bytes(m68k_jit *jit, const char *bytes, uint32_t count)
+{
+	memcpy(EMIT_PTR, bytes, count);
+	jit->used += count;
+}
+
+// data writes or MOVEM to memory, which may flush translated code
+static int jit_may_write(uint32_t opcode)
+{
+	return M68K_OPCODE_INFO(opcode)->writes || (opcode & 0xFF80) == 0x4880;
+}
+
+static m68k_jit_block* jit_translate(m68k_context *m68k, uint32_t pc)
+{
+	m68k_jit *jit = m68k->jit;
+	const m68k_cache_block *source;
+	m68k_jit_block *block;
+	uint8_t *to_slot[M68K_CACHE_BLOCK_LENGTH];
+	uint8_t *to_stop[M68K_CACHE_BLOCK_LENGTH];
+	uint8_t *to_flush[M68K_CACHE_BLOCK_LENGTH];
+	uint8_t *to_exit[2];
+	uint8_t *slot, *exit, *stop;
+	uint32_t i, k, slots, flushes;
+
+	if (jit->count >= M68K_JIT_BLOCKS
+	 || jit->used + M68K_JIT_BLOCK_CODE > M68K_JIT_CODE_SIZE)
+		m68k_jit_flush(m68k);
+
+	source = m68k_cache_block_at(m68k, pc);
+	block = &jit->block[jit->count++];
+	block->pc = pc;
+	block->linked = 0;
+	block->code = EMIT_PTR;
+
+	EMIT("\x53\x41\x54\x41\x55"); // push rbx; push r12; push r13
+	EMIT("\x48\x89\xFB");         // mov rbx, rdi
+	EMIT("\x45\x31\xE4");         // xor r12d, r12d
+	EMIT("\x49\xBD");             // mov r13, jit
+	emit64(jit, (uintptr_t)jit);
+
+	block->body = EMIT_PTR;
+	slots = 0;
+	flushes = 0;
+	for (i=0; i<source->count; ++i)
+	{
+		const m68k_cache_entry *entry = &source->entry[i];
+
+		EMIT("\xC7\x83"); // mov dword [rbx+opcode], opcode
+		emit32(jit, OFFSET_OPCODE);
+		emit32(jit, entry->opcode);
+		if (entry->length > 1)
+		{
+			for (k=0; k+1<entry->length; ++k)
+			{
+				EMIT("\x66\xC7\x83"); // mov word [rbx+ext_words+k*2], ext
+				emit32(jit, OFFSET_EXT_WORDS + k*2);
+				emit16(jit, entry->ext[k]);
+			}
+			EMIT("\x48\x8D\x83"); // lea rax, [rbx+ext_words]
+			emit32(jit, OFFSET_EXT_WORDS);
+			EMIT("\x48\x89\x83"); // mov [rbx+ext], rax
+			emit32(jit, OFFSET_EXT);
+		}
+		EMIT("\xC7\x83"); // mov dword [rbx+pc], pc+2
+		emit32(jit, OFFSET_PC);
+		emit32(jit, entry->pc + 2);
+
+		EMIT("\x48\x89\xDF"); // mov rdi, rbx
+		EMIT("\x48\xB8");     // mov rax, handler
+		// run slice ends at chain slot or after write, where flags are live
+		if (entry->nf_handler && !jit_may_write(entry->opcode))
+			emit64(jit, (uintptr_t)entry->nf_handler);
+		else
+			emit64(jit, (uintptr_t)entry->handler);
+		EMIT("\xFF\xD0");     // call rax
+		EMIT("\x85\xC0");     // test eax, eax
+		to_stop[i] = emit_jcc(jit, CC_E);
+		EMIT("\x41\x01\xC4"); // add r12d, eax
+
+		// write to code has flushed, rest of block may be stale
+		if (jit_may_write(entry->opcode))
+		{
+			EMIT("\x41\x81\x7D"); // cmp dword [r13+generation], generation
+			emit8(jit, offsetof(m68k_jit, generation));
+			emit32(jit, jit->generation);
+			to_flush[flushes++] = emit_jcc(jit, CC_NE);
+		}
+
+		if (i + 1 < source->count)
+		{
+			EMIT("\x81\xBB"); // cmp dword [rbx+pc], next pc
+			emit32(jit, OFFSET_PC);
+			emit32(jit, source->entry[i+1].pc);
+			to_slot[slots++] = emit_jcc(jit, CC_NE);
+		}
+	}
+
+	// chain slot, every exit from block goes here
+	slot = EMIT_PTR;
+	EMIT("\x48\xB8");         // mov rax, block
+	emit64(jit, (uintptr_t)block);
+	EMIT("\x49\x89\x45");     // mov [r13+last], rax
+	emit8(jit, offsetof(m68k_jit, last));
+	EMIT("\x81\xBB");         // cmp dword [rbx+pc], successor pc
+	emit32(jit, OFFSET_PC);
+	block->slot_pc = EMIT_PTR;
+	emit32(jit, M68K_CACHE_FREE);
+	to_exit[0] = emit_jcc(jit, CC_NE);
+	EMIT("\x45\x3B\x65");     // cmp r12d, [r13+budget]
+	emit8(jit, offsetof(m68k_jit, budget));
+	to_exit[1] = emit_jcc(jit, CC_AE);
+	EMIT("\xE9");             // jmp successor
+	block->slot_jmp = EMIT_PTR;
+	emit32(jit, 0);
+
+	exit = EMIT_PTR;
+	EMIT("\x44\x89\xE0");     // mov eax, r12d
+	EMIT("\x41\x5D\x41\x5C\x5B\xC3"); // pop r13; pop r12; pop rbx; ret
+
+	// handler has set next_func, pass cycles of previous instructions to it
+	stop = EMIT_PTR;
+	EMIT("\x44\x01\xA3");     // add [rbx+timeout], r12d
+	emit32(jit, OFFSET_TIMEOUT);
+	EMIT("\x49\xC7\x45");     // mov qword [r13+last], 0
+	emit8(jit, offsetof(m68k_jit, last));
+	emit32(jit, 0);
+	EMIT("\x31\xC0");         // xor eax, eax
+	EMIT("\x41\x5D\x41\x5C\x5B\xC3"); // pop r13; pop r12; pop rbx; ret
+
+	for (i=0; i<slots; ++i)
+		emit_fix(to_slot[i], slot);
+	for (i=0; i<flushes; ++i)
+		emit_fix(to_flush[i], exit);
+	for (i=0; i<source->count; ++i)
+		emit_fix(to_stop[i], stop);
+	emit_fix(to_exit[0], exit);
+	emit_fix(to_exit[1], exit);
+	emit_fix(block->slot_jmp, exit);
+
+	jit->map[(pc >> 1) & (M68K_JIT_MAP - 1)] = block;
+
+	if (jit->perf_map)
+	{
+		fprintf(jit->perf_map, "%lx %x m68k_%06X\n", (unsigned long)(uintptr_t)block->code,
+			(unsigned)(EMIT_PTR - block->code), pc & 0xFFFFFF);
+		fflush(jit->perf_map);
+	}
+	return block;
+}
+
+static void jit_link(m68k_jit_block *from, m68k_jit_block *to)
+{
+	memcpy(from->slot_pc, &to->pc, 4);
+	emit_fix(from->slot_jmp, to->body);
+	from->linked = 1;
+}
+
+uint32_t m68k_jit_execute(m68k_context *m68k, uint32_t budget)
+{
+	m68k_jit *jit = m68k->jit;
+	m68k_jit_block *block = jit->map[(PC >> 1) & (M68K_JIT_MAP - 1)];
+	uint32_t generation, time;
+
+	if (!block || block->pc != PC)
+		block = jit_translate(m68k, PC);
+
+	// successor check is in chain slot, so any link is safe
+	if (jit->last && !jit->last->linked)
+		jit_link(jit->last, block);
+
+	jit->last = 0;
+	jit->budget = budget;
+	generation = jit->generation;
+	time = ((m68k_fast_function)(void*)block->code)(m68k);
+
+	// translated code has stored block which is gone
+	if (jit->generation != generation)
+		jit->last = 0;
+	return time;
+}
+
+void m68k_jit_flush(m68k_context *m68k)
+{
+	m68k_jit *jit = m68k->jit;
+
+	// code which is running now leaves at next chain slot
+	jit->budget = 0;
+	jit->last = 0;
+	jit->used = 0;
+	jit->count = 0;
+	++jit->generation;
+	memset(jit->map, 0, sizeof(jit->map));
+}
+
+int m68k_jit_enable(m68k_context *m68k, int perf_map)
+{
+#ifdef M68K_JIT_SUPPORTED
+	m68k_jit *jit;
+	char name[64];
+
+	if (m68k->jit)
+		return 1;
+
+	if (!m68k_cache_enable(m68k))
+		return 0;
+
+	jit = (m68k_jit*)calloc(1, sizeof(m68k_jit));
+	if (!jit)
+		return 0;
+
+	jit->code = (uint8_t*)mmap(0, M68K_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED)
+	{
+		free(jit);
+		return 0;
+	}
+
+	if (perf_map)
+	{
+		sprintf(name, "/tmp/perf-%d.map", (int)getpid());
+		jit->perf_map = fopen(name, "a");
+	}
+
+	m68k->jit = jit;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void m68k_jit_disable(m68k_context *m68k)
+{
+	m68k_jit *jit = m68k->jit;
+
+	if (!jit)
+		return;
+
+#ifdef M68K_JIT_SUPPORTED
+	munmap(jit->code, M68K_JIT_CODE_SIZE);
+#endif
+	if (jit->perf_map)
+		fclose(jit->perf_map);
+	m68k->jit = 0;
+	free(jit);
+}
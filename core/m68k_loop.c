@@ -0,0 +1,198 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Bulk run of dbf loops which fill or copy plain memory in fast core.
+// Recognized loop is single move to (An)+ followed by dbf back to it:
+//   move.x Dn,(An)+ / move.x (Am)+,(An)+ / clr.x (An)+
+//   dbf Dk,loop
+// One iteration is run as usual to measure its cycles, then taken
+// iterations fitting into budget are done on host memory at once and
+// last one is left to fast core, so exit of loop isn't special.
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+#include "m68k_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ADDRESS_MASK 0xFFFFFF
+
+struct m68k_loop_
+{
+	uint32_t start, end; // plain memory
+	uint8_t *memory;     // host copy of [start, end), big endian
+};
+
+static uint32_t loop_step(m68k_context *m68k)
+{
+	uint32_t i, length;
+
+	m68k->opcode = READ_16(PC);
+	length = m68k_fast_opcode_length[m68k->opcode];
+	for (i=1; i<length; ++i)
+		m68k->ext_words[i-1] = READ_16(PC + i*2);
+	m68k->ext = m68k->ext_words;
+	PC += 2;
+	return M68K_FAST_HANDLER(m68k->opcode)(m68k);
+}
+
+// host pointer to [address, address + size) or 0 if it's not plain memory
+static uint8_t* loop_memory(m68k_loop *loop, uint32_t address, uint32_t size)
+{
+	address &= ADDRESS_MASK;
+	if (address < loop->start
+	 || address + size > loop->end)
+		return 0;
+	return loop->memory + (address - loop->start);
+}
+
+#define LOOP_FILL 0  // move.x Dn,(An)+
+#define LOOP_CLEAR 1 // clr.x (An)+
+#define LOOP_COPY 2  // move.x (Am)+,(An)+
+
+uint32_t m68k_loop_skip(m68k_context *m68k, uint32_t cycles, uint32_t budget)
+{
+	m68k_loop *loop = m68k->loop;
+	uint32_t head = PC, body, dbf, time, step;
+	uint32_t kind, size, dst, src, count, value, bytes, i;
+	uint8_t *to, *from;
+
+	body = READ_16(head);
+	dbf = READ_16(head + 2);
+	if ((dbf & 0xFFF8) != 0x51C8
+	 || READ_16(head + 4) != 0xFFFC)
+		return cycles;
+
+	if ((body & 0xC000) == 0 && (body & 0x3000) && ((body>>6)&7) == 3)
+	{
+		switch ((body>>12)&3)
+		{
+			case 1: size = 1; break;
+			case 3: size = 2; break;
+			default: size = 4; break;
+		}
+		switch ((body>>3)&7)
+		{
+			case 0: kind = LOOP_FILL; break;
+			case 3: kind = LOOP_COPY; break;
+			default: return cycles;
+		}
+		dst = (body>>9)&7;
+		src = body&7;
+	}
+	else if ((body & 0xFF38) == 0x4218 && (body & 0xC0) != 0xC0)
+	{
+		kind = LOOP_CLEAR;
+		size = 1<<((body>>6)&3);
+		dst = body&7;
+		src = 0;
+	}
+	else
+		return cycles;
+
+	// byte access moves a7 by 2, counter as fill value changes every iteration
+	if (dst == 7 || (kind == LOOP_COPY && (src == 7 || src == dst))
+	 || (kind == LOOP_FILL && src == (dbf&7)))
+		return cycles;
+
+	// one iteration as usual, also gives flags of move
+	time = 0;
+	for (i=0; i<2 && cycles + time < budget; ++i)
+	{
+		if (!(step = loop_step(m68k)))
+		{
+			m68k->timeout += cycles + time; // next_func is set by handler
+			return 0;
+		}
+		time += step;
+	}
+	cycles += time;
+	if (i != 2 || PC != head || cycles >= budget)
+		return cycles;
+
+	// all but last taken iteration, last one leaves loop in fast core
+	count = (uint16_t)REG_D(dbf&7);
+	if (count == 0xFFFF)
+		return cycles;
+	if (count > (budget - cycles) / time)
+		count = (budget - cycles) / time;
+	if (!count)
+		return cycles;
+
+	bytes = count*size;
+	to = loop_memory(loop, REG_A(dst), bytes);
+	if (!to)
+		return cycles;
+
+	if (kind == LOOP_COPY)
+	{
+		from = loop_memory(loop, REG_A(src), bytes);
+		if (!from)
+			return cycles;
+
+		// element by element copy repeats data if it overlaps forward
+		if (from < to && from + bytes > to)
+			return cycles;
+		memmove(to, from, bytes);
+
+		value = 0;
+		for (i=0; i<size; ++i)
+			value = (value<<8)|to[bytes - size + i];
+		SET_N_FLAG((value >> (size*8 - 1)) & 1);
+		SET_Z_FLAG(value == 0);
+		REG_A(src) += bytes;
+	}
+	else
+	{
+		// flags are same as after measured iteration
+		value = kind == LOOP_FILL ? REG_D(src) : 0;
+		for (i=0; i<bytes; ++i)
+			to[i] = value >> ((size - 1 - i%size)*8);
+	}
+
+	if (m68k->cache)
+		m68k_cache_invalidate(m68k, REG_A(dst), REG_A(dst) + bytes);
+	REG_A(dst) += bytes;
+	SET_DN_REG16(dbf&7, REG_D(dbf&7) - count);
+	return cycles + count*time;
+}
+
+int m68k_loop_enable(m68k_context *m68k, uint32_t start, uint32_t end, uint8_t *memory)
+{
+	m68k_loop *loop = m68k->loop;
+
+	if (!loop)
+	{
+		loop = (m68k_loop*)malloc(sizeof(m68k_loop));
+		if (!loop)
+			return 0;
+	}
+
+	loop->start = start;
+	loop->end = end;
+	loop->memory = memory;
+	m68k->loop = loop;
+	return 1;
+}
+
+void m68k_loop_disable(m68k_context *m68k)
+{
+	free(m68k->loop);
+	m68k->loop = 0;
+}
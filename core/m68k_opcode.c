@@ -17,6 +17,8 @@
 
 #include "m68k.h"
 #include "m68k_opcode.h"
+#include "m68k_fast_optable.h"
+#include "m68k_states.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -27,44 +29,294 @@ M68K_FUNCTION(invalid)
 	TIMEOUT(1<<20, invalid); // almost maximum int32
 }
 
-M68K_FUNCTION(done_wait_wb) { WAIT_BUS(done_wait_wb, done_write_wb); }
+M68K_FAST_FUNCTION(fast_invalid)
+{
+	invalid(m68k);
+	return 0;
+}
 
-M68K_FUNCTION(done_write_wb)
+M68K_CONT_FUNCTION(cont_invalid)
 {
-	WRITE_8(EA, EV);
-	FETCH_OPCODE;
+	invalid(m68k);
+	return (m68k_cont){cont_invalid, m68k->timeout};
 }
 
-M68K_FUNCTION(done_wait_ww) { WAIT_BUS(done_wait_ww, done_write_ww); }
+void m68k_init(m68k_context *m68k)
+{
+	//if (!opcode_table[0])
+	//	build_opcode_table();
 
-M68K_FUNCTION(done_write_ww)
+	memset(m68k->reg, 0, sizeof(m68k->reg));
+	m68k->fetched_value = 0;
+	m68k->cycles = 0;
+	m68k->mode = M68K_MODE_CYCLE;
+	m68k->state = M68K_STATE_reset_exception;
+	m68k->cont_func = 0; // continuation core starts from state
+	m68k->stopped = 0;
+	m68k->flag_kind = M68K_FLAGS_NONE;
+	TIMEOUT(40-6*4, reset_exception);
+}
+
+uint32_t* m68k_flags(m68k_context *m68k)
 {
-	WRITE_16(EA, EV);
-	FETCH_OPCODE;
+	uint32_t src = m68k->flag_src, dest = m68k->flag_dest, res = m68k->flag_res;
+	uint32_t *sr = &m68k->reg[M68K_REG_SR];
+	uint32_t v = 0, c = 0;
+
+	switch (m68k->flag_kind)
+	{
+		case M68K_FLAGS_NONE:
+			return sr;
+		case M68K_FLAGS_ADD:
+			v = FLAG_ADD_V(src, dest, res);
+			c = FLAG_ADD_C(src, dest, res);
+			break;
+		case M68K_FLAGS_SUB:
+			v = FLAG_SUB_V(src, dest, res);
+			c = FLAG_SUB_C(src, dest, res);
+			break;
+	}
+	m68k->flag_kind = M68K_FLAGS_NONE;
+
+	*sr &= ~(M68K_FLAG_N_MASK|M68K_FLAG_Z_MASK|M68K_FLAG_V_MASK|M68K_FLAG_C_MASK);
+	*sr |= ((res >> 31)<<M68K_FLAG_N_BIT) | ((res == 0)<<M68K_FLAG_Z_BIT)
+	     | (v<<M68K_FLAG_V_BIT) | (c<<M68K_FLAG_C_BIT);
+	return sr;
 }
 
-M68K_FUNCTION(done_wait_wl) { WAIT_BUS(done_wait_wl, done_write_wl); }
+// ones in low 16 bits
+static uint32_t popcount16(uint32_t x)
+{
+	x &= 0xFFFF;
+	x = (x & 0x5555) + ((x >> 1) & 0x5555);
+	x = (x & 0x3333) + ((x >> 2) & 0x3333);
+	x = (x & 0x0F0F) + ((x >> 4) & 0x0F0F);
+	return (x & 0x00FF) + (x >> 8);
+}
 
-M68K_FUNCTION(done_write_wl)
+// 38+2n, n is ones of source
+uint32_t m68k_mulu_time(uint32_t src)
 {
-	WRITE_16(EA, EV>>16);
-	WAIT_BUS(done_wait_wl2, done_write_wl2);
+	return 38 - READ_WAIT_TIME + 2*popcount16(src);
 }
 
-M68K_FUNCTION(done_wait_wl2) { WAIT_BUS(done_wait_wl2, done_write_wl2); }
+// 38+2n, n is 01 and 10 pairs of source with 0 appended below it
+uint32_t m68k_muls_time(uint32_t src)
+{
+	return 38 - READ_WAIT_TIME + 2*popcount16(src ^ (src << 1));
+}
 
-M68K_FUNCTION(done_write_wl2)
+// closed form of DIVU and DIVS timing found by Jorge Cwik. microcode makes
+// 15 steps of 2 cycles each for quotient bits 15-1, minus one if bit is
+// set, minus one more if partial remainder was shifted out of 16 bits,
+// which happens only for divisors above 0x8000
+uint32_t m68k_divu_time(uint32_t dividend, uint32_t divisor)
 {
-	WRITE_16(EA + 2, EV);
-	FETCH_OPCODE;
+	uint32_t quotient, carries = 0;
+	int i;
+
+	divisor &= 0xFFFF;
+	if ((dividend >> 16) >= divisor) // overflow
+		return 10 - READ_WAIT_TIME;
+
+	quotient = dividend / divisor;
+	if (divisor > 0x8000)
+		for (i=0; i<15; ++i)
+			carries += (dividend >> (16-i)) - divisor*(quotient >> (16-i)) >= 0x8000;
+	return 2*(38 + 30 - popcount16(quotient >> 1) - carries) - READ_WAIT_TIME;
 }
 
-void m68k_init(m68k_context *m68k)
+// same on absolute values, 2 cycles for each clear bit of quotient 15-1
+uint32_t m68k_divs_time(uint32_t dividend, uint32_t divisor)
 {
-	//if (!opcode_table[0])
-	//	build_opcode_table();
+	uint32_t time = 6, a_dividend, a_divisor, quotient;
 
-	memset(m68k->reg, 0, sizeof(m68k->reg));
-	m68k->fetched_value = 0;
-	TIMEOUT(40-6*4, reset_exception);
+	a_dividend = (int32_t)dividend < 0 ? 0 - dividend : dividend;
+	a_divisor = divisor & 0x8000 ? 0x10000 - (divisor & 0xFFFF) : divisor & 0xFFFF;
+	if ((int32_t)dividend < 0)
+		++time;
+	if ((a_dividend >> 16) >= a_divisor) // overflow
+		return 2*(time + 2) - READ_WAIT_TIME;
+
+	quotient = a_dividend / a_divisor;
+	time += 55 + 15 - popcount16(quotient >> 1);
+	if (!(divisor & 0x8000))
+		time = (int32_t)dividend < 0 ? time + 1 : time - 1;
+	return 2*time - READ_WAIT_TIME;
+}
+
+// registers of mask from D0 up, mask of -(An) has A7 in bit 0
+static uint32_t movem_regs(uint32_t mask, int predec, uint8_t *regs)
+{
+	uint32_t i, n = 0;
+
+	for (i=0; i<16; ++i)
+		if (mask & (1 << (predec ? 15-i : i)))
+			regs[n++] = i;
+	return n;
+}
+
+uint32_t m68k_lowest_bit(uint32_t mask)
+{
+	uint32_t i = 0;
+
+	while (!(mask & (1 << i)))
+		++i;
+	return i;
+}
+
+uint32_t m68k_movem_read(m68k_context *m68k, uint32_t address, uint32_t mask, uint32_t size)
+{
+	uint16_t words[32];
+	uint8_t regs[16];
+	uint32_t i, n, count;
+
+	n = movem_regs(mask, 0, regs);
+	count = n << (size - 1);
+	if (!m68k->read_block || !m68k->read_block(m68k, address, words, count))
+		for (i=0; i<count; ++i)
+			words[i] = READ_16(address + i*2);
+
+	for (i=0; i<n; ++i)
+		if (size == 2)
+			m68k->reg[regs[i]] = ((uint32_t)words[i*2] << 16) | words[i*2+1];
+		else
+			m68k->reg[regs[i]] = (int16_t)words[i];
+	return count;
+}
+
+// words of -(An) are below address and are written from top down
+uint32_t m68k_movem_write(m68k_context *m68k, uint32_t address, uint32_t mask, uint32_t size, int predec)
+{
+	uint16_t words[32];
+	uint8_t regs[16];
+	uint32_t i, n, count;
+
+	n = movem_regs(mask, predec, regs);
+	count = n << (size - 1);
+	for (i=0; i<n; ++i)
+		if (size == 2)
+		{
+			words[i*2] = m68k->reg[regs[i]] >> 16;
+			words[i*2+1] = m68k->reg[regs[i]];
+		}
+		else
+			words[i] = m68k->reg[regs[i]];
+
+	if (predec)
+		address -= count*2;
+	if (m68k->write_block && m68k->write_block(m68k, address, words, count))
+		return count;
+
+	if (predec)
+		for (i=count; i--; )
+			WRITE_16(address + i*2, words[i]);
+	else
+		for (i=0; i<count; ++i)
+			WRITE_16(address + i*2, words[i]);
+	return count;
+}
+
+int m68k_interrupt(m68k_context *m68k, uint32_t level)
+{
+	if (!m68k->stopped
+	 || (level < 7 && level <= ((SR & M68K_FLAG_I_MASK) >> M68K_FLAG_I0_BIT)))
+		return 0;
+
+	// all cores continue from interrupt exception
+	m68k->stopped = 0;
+	m68k->operand = M68K_AUTOVECTOR + level;
+	m68k->state = M68K_STATE_interrupt;
+	m68k->cont_func = 0;
+	TIMEOUT(44-6*4, interrupt);
+	return 1;
+}
+
+// budget is amount of cycles translated code may chain through
+static void m68k_continue(m68k_context *m68k, uint32_t budget)
+{
+	uint32_t time, i, length, pc = PC;
+	m68k_fast_function block;
+
+	if (m68k->mode != M68K_MODE_CYCLE
+	 && m68k->next_func == opcode_read)
+	{
+		if (m68k->mode == M68K_MODE_JIT && m68k->jit)
+			time = m68k_jit_execute(m68k, budget);
+		else if (m68k->mode == M68K_MODE_HYBRID && m68k->hybrid)
+			time = m68k_hybrid_execute(m68k);
+		else if (m68k->rec && (block = m68k_rec_find(m68k, PC)))
+			time = block(m68k);
+		else if (m68k->cache)
+			time = m68k_cache_execute(m68k, budget);
+		else
+		{
+			m68k->opcode = READ_16(PC);
+			if (m68k->profile)
+				m68k_profile_count(m68k);
+			length = m68k_fast_opcode_length[m68k->opcode];
+			for (i=1; i<length; ++i)
+				m68k->ext_words[i-1] = READ_16(PC + i*2);
+			m68k->ext = m68k->ext_words;
+			PC += 2;
+			time = M68K_FAST_FUSED_HANDLER(m68k->opcode)(m68k);
+		}
+		// skipping in hybrid mode would run exact accesses in one step
+		if (time && time < budget && PC <= pc && m68k->mode != M68K_MODE_HYBRID)
+		{
+			if (m68k->loop && (m68k->opcode & 0xFFF8) == 0x51C8)
+				time = m68k_loop_skip(m68k, time, budget);
+			else if (m68k->idle && pc - PC <= M68K_IDLE_MAX_LOOP)
+				time = m68k_idle_skip(m68k, time, budget);
+		}
+		if (time)
+			TIMEOUT(time, opcode_read);
+	}
+	else
+	{
+		m68k_function func = m68k->next_func;
+
+		func(m68k);
+		// opcode is just fetched and decoded
+		if (m68k->profile && func == opcode_read)
+			m68k_profile_count(m68k);
+	}
+}
+
+void m68k_update(m68k_context *m68k)
+{
+	++m68k->cycles;
+	if (!(--m68k->timeout))
+	{
+		m68k_continue(m68k, 0);
+		FLUSH_FLAGS;
+	}
+}
+
+uint32_t m68k_run(m68k_context *m68k, uint32_t cycles)
+{
+	return (uint32_t)m68k_run_until(m68k, m68k->cycles + cycles);
+}
+
+uint64_t m68k_run_until(m68k_context *m68k, uint64_t target)
+{
+	uint64_t start = m68k->cycles;
+	uint64_t left;
+
+	if (target <= start)
+		return 0;
+
+	// jump from one continuation to another while they fit into target
+	while (m68k->cycles + m68k->timeout <= target)
+	{
+		m68k->cycles += m68k->timeout;
+		left = target - m68k->cycles;
+		m68k_continue(m68k, left < 0xFFFFFFFF ? (uint32_t)left : 0xFFFFFFFF);
+	}
+
+	// rest of cycles are partially consumed by pending continuation
+	m68k->timeout -= (uint32_t)(target - m68k->cycles);
+	m68k->cycles = target;
+	FLUSH_FLAGS;
+	return target - start;
 }
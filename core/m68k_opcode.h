@@ -22,8 +22,25 @@
 #include "m68k.h"
 #include "m68k_optable.h"
 
+#ifdef M68K_FAST
+// fast handlers pass exceptions to cycle-split core and return 0
+#define INVALID if (1) {invalid(m68k); return 0;} else (void)0
+#define ADDRESS_EXCEPTION if (1) {TIMEOUT(cycles+50-4*(4+7), address_exception); return 0;} else (void)0
+#define ZERO_DIVIDE if (1) {OP = M68K_ZERO_DIVIDE_VECTOR; TIMEOUT(cycles+38-4*(4+3), trap_exception); return 0;} else (void)0
+#elif defined(M68K_CONT)
+#define INVALID return cont_invalid(m68k)
+#define ADDRESS_EXCEPTION if (1) TIMEOUT(50-4*(4+7), address_exception); else (void*)0
+#define ZERO_DIVIDE if (1) {OP = M68K_ZERO_DIVIDE_VECTOR; TIMEOUT(38-4*(4+3), trap_exception);} else (void)0
+#elif defined(M68K_THREADED)
+// invalid is a state of threaded core, jump there immediately
+#define INVALID TIMEOUT(0, invalid)
+#define ADDRESS_EXCEPTION if (1) TIMEOUT(50-4*(4+7), address_exception); else (void*)0
+#define ZERO_DIVIDE if (1) {OP = M68K_ZERO_DIVIDE_VECTOR; TIMEOUT(38-4*(4+3), trap_exception);} else (void)0
+#else
 #define INVALID invalid(m68k)
 #define ADDRESS_EXCEPTION if (1) TIMEOUT(50-4*(4+7), address_exception); else (void*)0
+#define ZERO_DIVIDE if (1) {OP = M68K_ZERO_DIVIDE_VECTOR; TIMEOUT(38-4*(4+3), trap_exception); return;} else (void)0
+#endif
 #define PRIVILEGE_EXCEPTION INVALID
 #define HALT
 
@@ -41,8 +58,18 @@ else SP = USP
 #define BUS_WAIT_TIME 1
 #define READ_WAIT_TIME 4
 
+// stopped CPU is left in state which comes this late, so it costs nothing
+#define M68K_STOP_TIMEOUT 0x80000000
+#define M68K_AUTOVECTOR 24 // vector of level 0
+#define M68K_ZERO_DIVIDE_VECTOR 5
+
 #define PC (m68k->reg[M68K_REG_PC])
+#ifdef M68K_LAZY_FLAGS
+// pending NZVC are stored into SR before any access to it
+#define SR (*(m68k->flag_kind ? m68k_flags(m68k) : &m68k->reg[M68K_REG_SR]))
+#else
 #define SR (m68k->reg[M68K_REG_SR])
+#endif
 #define SP (m68k->reg[M68K_REG_A7])
 #define USP (m68k->reg[M68K_REG_USP])
 #define SSP (m68k->reg[M68K_REG_SSP])
@@ -53,25 +80,88 @@ else SP = USP
 #define REG_D(n) (m68k->reg[M68K_REG_D0+(n)])
 #define REG_A(n) (m68k->reg[M68K_REG_A0+(n)])
 
-#define READ_16(address) ((uint16_t)(m68k->read_w(m68k, (address))))
-#define READ_8(address) ((uint8_t)(READ_16(address&(~1))>>((address)&1?0:8)))
+// register fields of opcode, decoded at runtime by compact handlers
+#define OPCODE_RY (m68k->opcode&7)
+#define OPCODE_RX ((m68k->opcode>>9)&7)
+
+// pages of m68k->pages with M68K_PAGE_READ or M68K_PAGE_WRITE are accessed
+// inline, others go through callbacks. address is evaluated once
+static inline m68k_page* m68k_host_page(m68k_context *m68k, uint32_t address, uint32_t flag)
+{
+	m68k_page *page;
+
+	if (!m68k->pages)
+		return 0;
+	page = &m68k->pages[(address>>16)&0xFF];
+	return (page->flags & flag) ? page : 0;
+}
+
+static inline uint16_t m68k_read16(m68k_context *m68k, uint32_t address)
+{
+	m68k_page *page = m68k_host_page(m68k, address, M68K_PAGE_READ);
+
+	if (page)
+		return (uint16_t)((uint32_t)page->mem[address&0xFFFE]<<8 | page->mem[(address&0xFFFE)+1]);
+	return (uint16_t)m68k->read_w(m68k, address);
+}
+
+static inline uint8_t m68k_read8(m68k_context *m68k, uint32_t address)
+{
+	m68k_page *page = m68k_host_page(m68k, address, M68K_PAGE_READ);
+
+	if (page)
+		return page->mem[address&0xFFFF];
+	return (uint8_t)(m68k->read_w(m68k, address&(~1u))>>(address&1?0:8));
+}
+
+static inline void m68k_write16(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_page *page = m68k_host_page(m68k, address, M68K_PAGE_WRITE);
+
+	if (page)
+	{
+		page->mem[address&0xFFFE] = (uint8_t)(value>>8);
+		page->mem[(address&0xFFFE)+1] = (uint8_t)value;
+	}
+	else
+		m68k->write_w(m68k, address, value);
+}
 
-#define WRITE_16(address, value) m68k->write_w(m68k, (address), (value))
-#define WRITE_8(address, value) m68k->write_b(m68k, (address), (value))
+static inline void m68k_write8(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	m68k_page *page = m68k_host_page(m68k, address, M68K_PAGE_WRITE);
 
+	if (page)
+		page->mem[address&0xFFFF] = (uint8_t)value;
+	else
+		m68k->write_b(m68k, address, value);
+}
+
+#define READ_16(address) m68k_read16(m68k, (address))
+#define READ_8(address) m68k_read8(m68k, (address))
+
+#ifdef M68K_FAST
+// extension words are fetched before handler is called
+#define FETCH_16(address) (*m68k->ext++)
+#else
+#define FETCH_16(address) READ_16(address)
+#endif
+
+#define WRITE_16(address, value) m68k_write16(m68k, (address), (value))
+#define WRITE_8(address, value) m68k_write8(m68k, (address), (value))
+
+// X is never pending, so it's accessed directly
 #define GET_FLAG(bit) ((m68k->reg[M68K_REG_SR] >> (bit))&1)
 #define GET_X_FLAG()  (GET_FLAG(M68K_FLAG_X_BIT))
-#define GET_N_FLAG()  (GET_FLAG(M68K_FLAG_N_BIT))
-#define GET_Z_FLAG()  (GET_FLAG(M68K_FLAG_Z_BIT))
-#define GET_V_FLAG()  (GET_FLAG(M68K_FLAG_V_BIT))
-#define GET_C_FLAG()  (GET_FLAG(M68K_FLAG_C_BIT))
+#define GET_V_FLAG()  (FLUSH_FLAGS, GET_FLAG(M68K_FLAG_V_BIT))
+#define GET_C_FLAG()  (FLUSH_FLAGS, GET_FLAG(M68K_FLAG_C_BIT))
 
 #define SET_FLAG(bit,val) m68k->reg[M68K_REG_SR] = (m68k->reg[M68K_REG_SR]&(~(1<<(bit))))|((val)<<(bit))
 #define SET_X_FLAG(val) SET_FLAG(M68K_FLAG_X_BIT,val)
-#define SET_N_FLAG(val) SET_FLAG(M68K_FLAG_N_BIT,val)
-#define SET_Z_FLAG(val) SET_FLAG(M68K_FLAG_Z_BIT,val)
-#define SET_V_FLAG(val) SET_FLAG(M68K_FLAG_V_BIT,val)
-#define SET_C_FLAG(val) SET_FLAG(M68K_FLAG_C_BIT,val)
+#define SET_N_FLAG(val) (FLUSH_FLAGS, SET_FLAG(M68K_FLAG_N_BIT,val))
+#define SET_Z_FLAG(val) (FLUSH_FLAGS, SET_FLAG(M68K_FLAG_Z_BIT,val))
+#define SET_V_FLAG(val) (FLUSH_FLAGS, SET_FLAG(M68K_FLAG_V_BIT,val))
+#define SET_C_FLAG(val) (FLUSH_FLAGS, SET_FLAG(M68K_FLAG_C_BIT,val))
 
 #define SET_N_FLAG8(val) SET_N_FLAG(((val)>>7)&1)
 #define SET_N_FLAG16(val) SET_N_FLAG(((val)>>15)&1)
@@ -85,6 +175,81 @@ else SP = USP
 #define SET_V_FLAG16(src, dest, res) SET_V_FLAG((int16_t)(((src)^(res))&((dest)^(res)))<0?1:0)
 #define SET_V_FLAG32(src, dest, res) SET_V_FLAG((int32_t)(((src)^(res))&((dest)^(res)))<0?1:0)
 
+// NZVC of whole operation, operands are shifted so sign is bit 31
+#define FLAG_NORM(bits, v) ((uint32_t)(v) << (32-(bits)))
+#define FLAG_ADD_C(src, dest, res) ((res) < (src))
+#define FLAG_ADD_V(src, dest, res) ((((src)^(res)) & ((dest)^(res))) >> 31)
+#define FLAG_SUB_C(src, dest, res) ((dest) < (src))
+#define FLAG_SUB_V(src, dest, res) ((((src)^(dest)) & ((res)^(dest))) >> 31)
+
+#define M68K_FLAGS_NONE  0 // SR is up to date
+#define M68K_FLAGS_LOGIC 1 // N and Z by result, V and C cleared
+#define M68K_FLAGS_ADD   2 // dest + src
+#define M68K_FLAGS_SUB   3 // dest - src
+
+#ifdef M68K_LAZY_FLAGS
+// operation is recorded and NZVC are computed only if something reads them
+#define FLAGS_LAZY(kind, bits, src, dest, res) ( \
+	m68k->flag_src = FLAG_NORM(bits, src), \
+	m68k->flag_dest = FLAG_NORM(bits, dest), \
+	m68k->flag_res = FLAG_NORM(bits, res), \
+	m68k->flag_kind = (kind))
+#define FLAGS_LOGIC(bits, res) FLAGS_LAZY(M68K_FLAGS_LOGIC, bits, 0, 0, res)
+#define FLAGS_ADD(bits, src, dest, res) FLAGS_LAZY(M68K_FLAGS_ADD, bits, src, dest, res)
+#define FLAGS_SUB(bits, src, dest, res) FLAGS_LAZY(M68K_FLAGS_SUB, bits, src, dest, res)
+#define FLUSH_FLAGS (void)SR
+
+// N and Z don't depend on kind of operation
+#define GET_N_FLAG() (m68k->flag_kind ? m68k->flag_res >> 31 : GET_FLAG(M68K_FLAG_N_BIT))
+#define GET_Z_FLAG() (m68k->flag_kind ? m68k->flag_res == 0 : GET_FLAG(M68K_FLAG_Z_BIT))
+#else
+#define SET_FLAGS_NZVC(n, z, v, c) SR = (SR & ~(M68K_FLAG_N_MASK|M68K_FLAG_Z_MASK|M68K_FLAG_V_MASK|M68K_FLAG_C_MASK)) \
+	| ((n)<<M68K_FLAG_N_BIT) | ((z)<<M68K_FLAG_Z_BIT) | ((v)<<M68K_FLAG_V_BIT) | ((c)<<M68K_FLAG_C_BIT)
+#define FLAGS_LOGIC(bits, res) SET_FLAGS_NZVC(FLAG_NORM(bits, res) >> 31, FLAG_NORM(bits, res) == 0, 0, 0)
+#define FLAGS_ADD(bits, src, dest, res) SET_FLAGS_NZVC(FLAG_NORM(bits, res) >> 31, FLAG_NORM(bits, res) == 0, \
+	FLAG_ADD_V(FLAG_NORM(bits, src), FLAG_NORM(bits, dest), FLAG_NORM(bits, res)), \
+	FLAG_ADD_C(FLAG_NORM(bits, src), FLAG_NORM(bits, dest), FLAG_NORM(bits, res)))
+#define FLAGS_SUB(bits, src, dest, res) SET_FLAGS_NZVC(FLAG_NORM(bits, res) >> 31, FLAG_NORM(bits, res) == 0, \
+	FLAG_SUB_V(FLAG_NORM(bits, src), FLAG_NORM(bits, dest), FLAG_NORM(bits, res)), \
+	FLAG_SUB_C(FLAG_NORM(bits, src), FLAG_NORM(bits, dest), FLAG_NORM(bits, res)))
+#define FLUSH_FLAGS (void)0
+
+#define GET_N_FLAG()  (GET_FLAG(M68K_FLAG_N_BIT))
+#define GET_Z_FLAG()  (GET_FLAG(M68K_FLAG_Z_BIT))
+#endif
+
+// stores pending flags into SR, returns pointer to it
+uint32_t* m68k_flags(m68k_context *m68k);
+
+// results of ABCD [0] and SBCD [1] written by m68kgen into m68k_bcd_table.c,
+// NBCD is SBCD from 0. low byte is result, high byte is X, N, V and C of
+// CCR and Z bit if Z is to be cleared
+extern const uint16_t m68k_bcd_table[2][0x20000];
+#define BCD_INDEX(dst, src) ((GET_X_FLAG() << 16) | ((uint8_t)(dst) << 8) | (uint8_t)(src))
+#define SET_BCD_FLAGS(bcd) SR = (SR & ~(M68K_FLAG_X_MASK|M68K_FLAG_N_MASK|M68K_FLAG_V_MASK|M68K_FLAG_C_MASK \
+	|((bcd)>>8 & M68K_FLAG_Z_MASK))) | ((bcd)>>8 & ~M68K_FLAG_Z_MASK)
+
+// internal cycles of MULU, MULS, DIVU and DIVS depending on operands,
+// opcode fetch excluded, divisor is not 0
+uint32_t m68k_mulu_time(uint32_t src);
+uint32_t m68k_muls_time(uint32_t src);
+uint32_t m68k_divu_time(uint32_t dividend, uint32_t divisor);
+uint32_t m68k_divs_time(uint32_t dividend, uint32_t divisor);
+
+// MOVEM of fast core, size is 1 word or 2 long, mask of -(An) has A7 in
+// bit 0 and address is An before decrement. goes through read_block or
+// write_block if they take the range, returns words moved
+uint32_t m68k_movem_read(m68k_context *m68k, uint32_t address, uint32_t mask, uint32_t size);
+uint32_t m68k_movem_write(m68k_context *m68k, uint32_t address, uint32_t mask, uint32_t size, int predec);
+
+// register of MOVEM moved next by cycle-split states, mask is not 0
+uint32_t m68k_lowest_bit(uint32_t mask);
+#ifdef __GNUC__
+#define LOWEST_BIT(mask) ((uint32_t)__builtin_ctz(mask))
+#else
+#define LOWEST_BIT(mask) m68k_lowest_bit(mask)
+#endif
+
 #define SET_VAR8(var, val) (var) = ((var)&(~0xFF))|(val)
 #define SET_VAR16(var, val) (var) = ((var)&(~0xFFFF))|(val)
 #define SET_VAR32(var, val) (var) = val
@@ -120,11 +285,98 @@ if (BUS_BUSY) \
 else \
 	TIMEOUT(READ_WAIT_TIME, bus_access)
 
+#ifdef M68K_THREADED
+// states are labels inside m68k_threaded_run_until
+#if defined(__GNUC__) && !defined(M68K_THREADED_SWITCH)
+#define M68K_LABELS_AS_VALUES
+#define THREAD_DISPATCH goto *state_label[state]
+#else
+#define THREAD_DISPATCH goto dispatch
+#endif
+
+#define M68K_STATE(name) L_##name:
+
+#define TIMEOUT(time,next) if (1) \
+{ \
+	state = M68K_STATE_##next; \
+	timeout = (time); \
+	if (cycles + timeout > target) \
+		goto leave; \
+	cycles += timeout; \
+	goto L_##next; \
+} else (void)0
+
+#define DECODE_OPCODE if (1) \
+{ \
+	state = m68k_threaded_opcode_state[m68k->opcode]; \
+	THREAD_DISPATCH; \
+} else (void)0
+#elif defined(M68K_CONT)
+// states return next continuation instead of storing it into context
+#define M68K_STATE(name) M68K_CONT_FUNCTION(cont_##name)
+
+#define TIMEOUT(time,next) return (m68k_cont){cont_##next, (time)}
+#define DECODE_OPCODE return M68K_CONT_HANDLER(m68k->opcode)(m68k)
+#else
 #define TIMEOUT(time,next) m68k->timeout = (time), m68k->next_func = (next)
+#define DECODE_OPCODE M68K_HANDLER(m68k->opcode)(m68k)
+#endif
+
+// m68k_fast_opcode_flags, flags-dead handlers of m68k_fast_nf_index are
+// used when next FLAGS_WRITE instruction follows through FLAGS_KEEP ones
+#define M68K_FAST_FLAGS_WRITE 1 // whole NZVC is overwritten without fault
+#define M68K_FAST_FLAGS_KEEP  2 // NZVC are not touched, no fault or jump
+
+// fetches and runs instruction at PC from block cache, returns its cycles
+// flags-dead handlers are used only while budget is not spent before next
+// flag writer, so run slice never ends with stale SR
+uint32_t m68k_cache_execute(m68k_context *m68k, uint32_t budget);
+
+// translated block of ROM starting at pc or 0
+m68k_fast_function m68k_rec_find(m68k_context *m68k, uint32_t pc);
+
+// same but through translated code, which may chain to next blocks
+// while less than budget cycles are spent
+uint32_t m68k_jit_execute(m68k_context *m68k, uint32_t budget);
+
+// loop back to PC is run once more and then skipped while it fits into
+// budget if it was idle, returns given cycles plus cycles of both
+// or 0 if next_func is set
+#define M68K_IDLE_MAX_LOOP 32 // bytes from branch back to loop head
+uint32_t m68k_idle_skip(m68k_context *m68k, uint32_t cycles, uint32_t budget);
 
+// same for fill/copy loop at PC just branched to by dbf
+uint32_t m68k_loop_skip(m68k_context *m68k, uint32_t cycles, uint32_t budget);
+
+// runs instruction at PC as one step if it touches only relaxed regions,
+// returns its cycles, otherwise starts cycle-split states and returns 0
+uint32_t m68k_hybrid_execute(m68k_context *m68k);
+
+// counts m68k->opcode as executed once
+void m68k_profile_count(m68k_context *m68k);
+
+#if defined(M68K_FAST)
+#define FETCH_OPCODE return cycles + READ_WAIT_TIME
+#elif defined(M68K_THREADED)
+// inlined opcode_read, so every instruction has its own dispatch branch
+#define FETCH_OPCODE if (BUS_BUSY) \
+	TIMEOUT(1, opcode_wait); \
+else if (1) \
+{ \
+	state = M68K_STATE_opcode_read; \
+	timeout = 4; \
+	if (cycles + timeout > target) \
+		goto leave; \
+	cycles += timeout; \
+	m68k->opcode = READ_16(PC); \
+	PC += 2; \
+	DECODE_OPCODE; \
+} else (void)0
+#else
 #define FETCH_OPCODE if (BUS_BUSY) \
 	TIMEOUT(1, opcode_wait); \
 else \
 	TIMEOUT(4, opcode_read)
+#endif
 
 #endif
@@ -0,0 +1,71 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Opcode counters for profile-guided generation, see "m68kgen profile=file".
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct m68k_profile_
+{
+	uint64_t count[0x10000];
+};
+
+void m68k_profile_count(m68k_context *m68k)
+{
+	++m68k->profile->count[m68k->opcode];
+}
+
+int m68k_profile_enable(m68k_context *m68k)
+{
+	// these run instructions without passing them to m68k_profile_count
+	if (m68k->cache || m68k->jit || m68k->rec || m68k->hybrid)
+		return 0;
+
+	if (!m68k->profile)
+		m68k->profile = (m68k_profile*)calloc(1, sizeof(m68k_profile));
+	return m68k->profile != 0;
+}
+
+void m68k_profile_disable(m68k_context *m68k)
+{
+	free(m68k->profile);
+	m68k->profile = 0;
+}
+
+int m68k_profile_save(m68k_context *m68k, const char *name)
+{
+	FILE *f;
+	int i;
+
+	if (!m68k->profile)
+		return 0;
+
+	f = fopen(name, "w");
+	if (!f)
+		return 0;
+
+	fprintf(f, "# opcode count, hex and decimal\n");
+	for (i=0; i<0x10000; ++i)
+		if (m68k->profile->count[i])
+			fprintf(f, "%04X %llu\n", i, (unsigned long long)m68k->profile->count[i]);
+	fclose(f);
+	return 1;
+}
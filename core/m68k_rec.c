@@ -0,0 +1,72 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Lookup of ROM blocks translated ahead of time.
+// Blocks are found by "m68kgen fast rom.bin" from reset and exception
+// vectors, everything it didn't reach runs in fast core as usual.
+
+#include "m68k.h"
+#include "m68k_opcode.h"
+
+#include <stdlib.h>
+
+struct m68k_rec_
+{
+	uint32_t mask;
+	const m68k_rec_block *slot[1]; // open addressing by pc
+};
+
+int m68k_rec_enable(m68k_context *m68k, const m68k_rec_block *blocks, uint32_t count)
+{
+	m68k_rec *rec;
+	uint32_t size, i, j;
+
+	m68k_rec_disable(m68k);
+
+	for (size = 1; size < count*2; size <<= 1);
+
+	rec = (m68k_rec*)calloc(1, sizeof(m68k_rec) + (size - 1)*sizeof(rec->slot[0]));
+	if (!rec)
+		return 0;
+
+	rec->mask = size - 1;
+	for (i=0; i<count; ++i)
+	{
+		for (j = (blocks[i].pc >> 1) & rec->mask; rec->slot[j]; j = (j + 1) & rec->mask);
+		rec->slot[j] = &blocks[i];
+	}
+
+	m68k->rec = rec;
+	return 1;
+}
+
+void m68k_rec_disable(m68k_context *m68k)
+{
+	free(m68k->rec);
+	m68k->rec = 0;
+}
+
+m68k_fast_function m68k_rec_find(m68k_context *m68k, uint32_t pc)
+{
+	m68k_rec *rec = m68k->rec;
+	uint32_t i;
+
+	for (i = (pc >> 1) & rec->mask; rec->slot[i]; i = (i + 1) & rec->mask)
+		if (rec->slot[i]->pc == pc)
+			return rec->slot[i]->run;
+	return 0;
+}
@@ -0,0 +1,421 @@
+/*
+    This file is part of GenStation.
+
+    GenStation is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GenStation is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GenStation.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmark of generated cores.
+// Link with m68k_opcode.c, m68k_cache.c, m68k_jit.c, m68k_rec.c, m68k_idle.c,
+// m68k_loop.c, m68k_hybrid.c, m68k_profile.c and output of "m68kgen",
+// "m68kgen fast", "m68kgen threaded" and "m68kgen cont".
+// For ahead of time translated run, write program with "m68kbench rom file",
+// translate it with "m68kgen fast file" and build with M68K_BENCH_REC defined
+// and m68k_rec_blocks.c linked.
+// For profile-guided cores, record profile with "m68kbench profile file"
+// and generate them with "m68kgen ... profile=file".
+// "m68kbench check" compares loop and idle skipping, block cache and JIT
+// with plain cores.
+
+#include "m68k.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RAM_SIZE (1<<16)
+
+static uint8_t ram[RAM_SIZE];
+
+// every page mirrors ram, same as handlers below
+static m68k_page pages[M68K_PAGE_COUNT];
+
+// reset vectors and loop which uses common instructions
+static const uint16_t program[] =
+{
+	0x0000, 0xFFF0,         // ssp
+	0x0000, 0x0008,         // pc
+	0x4E71,                 // 0008: nop
+	0x4E71,                 // 000A: nop
+	0x7200,                 // 000C: moveq #0,d1
+	0x7020,                 // 000E: moveq #32,d0
+	0x5240,                 // 0010: addq.w #1,d0
+	0x0C40, 0x0100,         // 0012: cmpi.w #$100,d0
+	0x66F8,                 // 0016: bne.s 0010
+	0x31C1, 0x8000,         // 0018: move.w d1,($8000).w
+	0x4A78, 0x8000,         // 001C: tst.w ($8000).w
+	0x5281,                 // 0020: addq.l #1,d1
+	0x0641, 0x0003,         // 0022: addi.w #3,d1
+	0x4841,                 // 0026: swap d1
+	0x4841,                 // 0028: swap d1
+	0x60E2,                 // 002A: bra.s 000E
+};
+
+// dbf loops of m68k_loop_enable, fill value of first one is its counter
+static const uint16_t loop_program[] =
+{
+	0x0000, 0xFFF0,         // ssp
+	0x0000, 0x0008,         // pc
+	0x307C, 0x1000,         // 0008: movea.w #$1000,a0
+	0x7007,                 // 000C: moveq #7,d0
+	0x30C0,                 // 000E: move.w d0,(a0)+
+	0x51C8, 0xFFFC,         // 0010: dbf d0,000E
+	0x7207,                 // 0014: moveq #7,d1
+	0x243C, 0x1234, 0x5678, // 0016: move.l #$12345678,d2
+	0x20C2,                 // 001C: move.l d2,(a0)+
+	0x51C9, 0xFFFC,         // 001E: dbf d1,001C
+	0x7207,                 // 0022: moveq #7,d1
+	0x4258,                 // 0024: clr.w (a0)+
+	0x51C9, 0xFFFC,         // 0026: dbf d1,0024
+	0x327C, 0x1000,         // 002A: movea.w #$1000,a1
+	0x720F,                 // 002E: moveq #15,d1
+	0x10D9,                 // 0030: move.b (a1)+,(a0)+
+	0x51C9, 0xFFFC,         // 0032: dbf d1,0030
+	0x60FE,                 // 0036: bra.s 0036
+};
+
+// flag writers and keepers, block cache leaves out flags of first ones
+static const uint16_t flags_program[] =
+{
+	0x0000, 0xFFF0,         // ssp
+	0x0000, 0x0008,         // pc
+	0x7001,                 // 0008: moveq #1,d0
+	0x5249,                 // 000A: addq.w #1,a1
+	0x72FF,                 // 000C: moveq #-1,d1
+	0x4E71,                 // 000E: nop
+	0x4A42,                 // 0010: tst.w d2
+	0x5380,                 // 0012: subq.l #1,d0
+	0x4E71,                 // 0014: nop
+	0x4480,                 // 0016: neg.l d0
+	0x7400,                 // 0018: moveq #0,d2
+	0x4E71,                 // 001A: nop
+	0x4E71,                 // 001C: nop
+	0x5242,                 // 001E: addq.w #1,d2
+	0x60E6,                 // 0020: bra.s 0008
+};
+
+// polling loop of m68k_idle_enable, flag is set by check between slices
+static const uint16_t idle_program[] =
+{
+	0x0000, 0xFFF0,         // ssp
+	0x0000, 0x0008,         // pc
+	0x0838, 0x0000, 0x1000, // 0008: btst #0,($1000).w
+	0x67F8,                 // 000E: beq.s 0008
+	0x5241,                 // 0010: addq.w #1,d1
+	0x4238, 0x1000,         // 0012: clr.b ($1000).w
+	0x60F0,                 // 0016: bra.s 0008
+};
+
+// code written by block which runs it
+static const uint16_t write_program[] =
+{
+	0x0000, 0xFFF0,         // ssp
+	0x0000, 0x0008,         // pc
+	0x31FC, 0x7005, 0x000E, // 0008: move.w #$7005,($000E).w
+	0x7001,                 // 000E: moveq #1,d0
+	0x60FE,                 // 0010: bra.s 0010
+};
+
+static uint32_t bench_read_w(m68k_context *m68k, uint32_t address)
+{
+	address &= RAM_SIZE-2;
+	return (ram[address]<<8)|ram[address+1];
+}
+
+static void bench_write_w(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	address &= RAM_SIZE-2;
+	ram[address] = value>>8;
+	ram[address+1] = value;
+}
+
+static void bench_write_b(m68k_context *m68k, uint32_t address, uint32_t value)
+{
+	ram[address&(RAM_SIZE-1)] = value;
+}
+
+static void bench_init_ram(const uint16_t *code, int words)
+{
+	int i;
+
+	memset(ram, 0, sizeof(ram));
+	for (i=0; i<words; ++i)
+	{
+		ram[i*2] = code[i]>>8;
+		ram[i*2+1] = code[i];
+	}
+}
+
+static void bench_init(m68k_context *m68k, const uint16_t *code, int words)
+{
+	bench_init_ram(code, words);
+
+	memset(m68k, 0, sizeof(*m68k));
+	m68k->read_w = bench_read_w;
+	m68k->write_w = bench_write_w;
+	m68k->write_b = bench_write_b;
+	m68k_init(m68k);
+}
+
+// cycles per one Genesis frame (NTSC)
+#define FRAME_CYCLES 127856
+
+#define BENCH_RUN      0
+#define BENCH_THREADED 1
+#define BENCH_CONT     2
+#define BENCH_CACHE    3
+#define BENCH_JIT      4
+#define BENCH_REC      5
+#define BENCH_HYBRID   6
+
+#ifdef M68K_BENCH_REC
+extern const m68k_rec_block m68k_rec_blocks[];
+extern const uint32_t m68k_rec_block_count;
+#endif
+
+static void bench(const char *name, int mode, int core, int paged, int frames)
+{
+	m68k_context m68k;
+	clock_t start;
+	double seconds;
+	int i;
+
+	bench_init(&m68k, program, sizeof(program)/sizeof(program[0]));
+	m68k.mode = mode;
+	if (paged)
+	{
+		for (i=0; i<M68K_PAGE_COUNT; ++i)
+		{
+			pages[i].mem = ram;
+			pages[i].flags = M68K_PAGE_READ | M68K_PAGE_WRITE;
+		}
+		m68k.pages = pages;
+	}
+	if (core == BENCH_CACHE)
+		m68k_cache_enable(&m68k);
+	if (core == BENCH_JIT && !m68k_jit_enable(&m68k, 0))
+	{
+		printf("%-10s not supported\n", name);
+		return;
+	}
+	if (core == BENCH_HYBRID && m68k_hybrid_enable(&m68k))
+	{
+		// ($8000).w is treated as I/O port
+		m68k_hybrid_region(&m68k, 0, RAM_SIZE, 0);
+		m68k_hybrid_region(&m68k, 0x8000, 0x8002, 1);
+	}
+#ifdef M68K_BENCH_REC
+	if (core == BENCH_REC)
+		m68k_rec_enable(&m68k, m68k_rec_blocks, m68k_rec_block_count);
+#endif
+
+	start = clock();
+	for (i=0; i<frames; ++i)
+	{
+		switch (core)
+		{
+			case BENCH_RUN:
+			case BENCH_CACHE:
+			case BENCH_JIT:
+			case BENCH_REC:
+			case BENCH_HYBRID: m68k_run(&m68k, FRAME_CYCLES); break;
+			case BENCH_THREADED: m68k_threaded_run_until(&m68k, m68k.cycles + FRAME_CYCLES); break;
+			case BENCH_CONT: m68k_cont_run_until(&m68k, m68k.cycles + FRAME_CYCLES); break;
+		}
+	}
+	seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	m68k_cache_disable(&m68k);
+	m68k_rec_disable(&m68k);
+	m68k_hybrid_disable(&m68k);
+
+	printf("%-10s %8.3f s %10.1f frames/s  pc=%06X d0=%08X d1=%08X\n", name, seconds,
+		seconds > 0 ? frames / seconds : 0.0,
+		m68k.reg[M68K_REG_PC], m68k.reg[M68K_REG_D0], m68k.reg[M68K_REG_D1]);
+}
+
+// fast core with loops run on host memory must end as cycle-split core
+static int check_loop(void)
+{
+	static uint8_t expected[RAM_SIZE];
+	uint32_t reg[M68K_REG_COUNT];
+	m68k_context m68k;
+	int ok;
+
+	bench_init(&m68k, loop_program, sizeof(loop_program)/sizeof(loop_program[0]));
+	m68k_run(&m68k, 10000);
+	memcpy(expected, ram, sizeof(ram));
+	memcpy(reg, m68k.reg, sizeof(reg));
+
+	bench_init(&m68k, loop_program, sizeof(loop_program)/sizeof(loop_program[0]));
+	m68k.mode = M68K_MODE_FAST;
+	if (!m68k_loop_enable(&m68k, 0, RAM_SIZE, ram))
+		return 0;
+	m68k_run(&m68k, 10000);
+	m68k_loop_disable(&m68k);
+
+	ok = !memcmp(expected, ram, sizeof(ram)) && !memcmp(reg, m68k.reg, sizeof(reg));
+	printf("%-10s %s\n", "loop", ok ? "ok" : "differs from cycle");
+	return ok;
+}
+
+// SR after any run slice of block cache must be same as of fast core
+static int check_cache_flags(void)
+{
+	m68k_context fast, cache;
+	int slice, i, ok = 1;
+
+	for (slice=1; slice<40 && ok; ++slice)
+	{
+		bench_init(&fast, flags_program, sizeof(flags_program)/sizeof(flags_program[0]));
+		fast.mode = M68K_MODE_FAST;
+		bench_init(&cache, flags_program, sizeof(flags_program)/sizeof(flags_program[0]));
+		cache.mode = M68K_MODE_FAST;
+		if (!m68k_cache_enable(&cache))
+			return 0;
+		for (i=0; i<100 && ok; ++i)
+		{
+			m68k_run(&fast, slice);
+			m68k_run(&cache, slice);
+			ok = !memcmp(fast.reg, cache.reg, sizeof(fast.reg));
+		}
+		m68k_cache_disable(&cache);
+	}
+	printf("%-10s %s\n", "cache sr", ok ? "ok" : "differs from fast");
+	return ok;
+}
+
+#define IDLE_SLICES 400
+
+// skipped polling must end every run slice where fast core alone does
+static int check_idle(void)
+{
+	static uint32_t reg[IDLE_SLICES][M68K_REG_COUNT];
+	static uint32_t timeout[IDLE_SLICES];
+	m68k_context m68k;
+	int pass, i, ok = 1;
+
+	for (pass=0; pass<2 && ok; ++pass)
+	{
+		bench_init(&m68k, idle_program, sizeof(idle_program)/sizeof(idle_program[0]));
+		m68k.mode = M68K_MODE_FAST;
+		if (pass && !m68k_idle_enable(&m68k, 0, RAM_SIZE))
+			return 0;
+		for (i=0; i<IDLE_SLICES && ok; ++i)
+		{
+			if (i%16 == 15)
+				ram[0x1000] = 1;
+			m68k_run(&m68k, 1 + i*37%500);
+			if (!pass)
+			{
+				memcpy(reg[i], m68k.reg, sizeof(reg[i]));
+				timeout[i] = m68k.timeout;
+			}
+			else
+				ok = !memcmp(reg[i], m68k.reg, sizeof(reg[i])) && timeout[i] == m68k.timeout;
+		}
+		m68k_idle_disable(&m68k);
+	}
+	printf("%-10s %s\n", "idle", ok ? "ok" : "differs from fast");
+	return ok;
+}
+
+// JIT must not run rest of block after it is written
+static int check_jit_write(void)
+{
+	m68k_context fast, jit;
+	int ok;
+
+	bench_init(&fast, write_program, sizeof(write_program)/sizeof(write_program[0]));
+	fast.mode = M68K_MODE_FAST;
+	m68k_run(&fast, 1000);
+
+	bench_init(&jit, write_program, sizeof(write_program)/sizeof(write_program[0]));
+	jit.mode = M68K_MODE_JIT;
+	if (!m68k_jit_enable(&jit, 0))
+	{
+		printf("%-10s not supported\n", "jit write");
+		return 1;
+	}
+	m68k_run(&jit, 1000);
+	m68k_cache_disable(&jit);
+
+	ok = !memcmp(fast.reg, jit.reg, sizeof(fast.reg));
+	printf("%-10s %s\n", "jit write", ok ? "ok" : "differs from fast");
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = 1000;
+	FILE *f;
+
+	if (argc > 2 && !strcmp(argv[1], "rom"))
+	{
+		bench_init_ram(program, sizeof(program)/sizeof(program[0]));
+		f = fopen(argv[2], "wb");
+		if (!f)
+			return 1;
+		fwrite(ram, 1, sizeof(program), f);
+		fclose(f);
+		return 0;
+	}
+
+	// opcode profile of fast core for "m68kgen profile=file"
+	if (argc > 2 && !strcmp(argv[1], "profile"))
+	{
+		m68k_context m68k;
+		int i;
+
+		if (argc > 3)
+			frames = atoi(argv[3]);
+		bench_init(&m68k, program, sizeof(program)/sizeof(program[0]));
+		m68k.mode = M68K_MODE_FAST;
+		if (!m68k_profile_enable(&m68k))
+			return 1;
+		for (i=0; i<frames; ++i)
+			m68k_run(&m68k, FRAME_CYCLES);
+		i = m68k_profile_save(&m68k, argv[2]);
+		m68k_profile_disable(&m68k);
+		return !i;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "check"))
+	{
+		int ok = check_loop();
+
+		ok &= check_idle();
+		ok &= check_cache_flags();
+		ok &= check_jit_write();
+		return !ok;
+	}
+
+	if (argc > 1)
+		frames = atoi(argv[1]);
+
+	bench("cycle", M68K_MODE_CYCLE, BENCH_RUN, 0, frames);
+	bench("fast", M68K_MODE_FAST, BENCH_RUN, 0, frames);
+	bench("threaded", M68K_MODE_CYCLE, BENCH_THREADED, 0, frames);
+	bench("cont", M68K_MODE_CYCLE, BENCH_CONT, 0, frames);
+	bench("cache", M68K_MODE_FAST, BENCH_CACHE, 0, frames);
+	bench("jit", M68K_MODE_JIT, BENCH_JIT, 0, frames);
+	bench("hybrid", M68K_MODE_HYBRID, BENCH_HYBRID, 0, frames);
+	bench("cycle pg", M68K_MODE_CYCLE, BENCH_RUN, 1, frames);
+	bench("cont pg", M68K_MODE_CYCLE, BENCH_CONT, 1, frames);
+	bench("fast pg", M68K_MODE_FAST, BENCH_RUN, 1, frames);
+	bench("cache pg", M68K_MODE_FAST, BENCH_CACHE, 1, frames);
+#ifdef M68K_BENCH_REC
+	bench("rec", M68K_MODE_FAST, BENCH_REC, 0, frames);
+#endif
+	return 0;
+}
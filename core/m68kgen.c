@@ -18,6 +18,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+
+FILE *out; // generated code, temporary file until functions are merged
 
 int is_checking(int opcode)
 {
@@ -87,15 +90,74 @@ int ea_address(int opcode)
 }
 
 #define MAX_NAME (100)
+#define M68K_MAX_EXT_WORDS (4) // same as in m68k.h
 #define HASH_SIZE (1<<18)
 #define HASH_MASK (HASH_SIZE-1)
 
 int func_hash[HASH_SIZE];
 int func_id[HASH_SIZE];
 char **func_names = 0;
+int *func_words = 0; // fetch_words of function, for shared compact handlers
+int *func_flags = 0; // flags_set of function
 int func_count = 0;
 int valid[0x10000];
 
+// generate instruction-granular core, one function per opcode
+int fast_mode = 0;
+
+// extension words fetched by current fast handler and resulting
+// instruction length in words (opcode included)
+int fetch_words = 0;
+int opcode_length[0x10000];
+
+// second pass of fast mode emitting fast_nf_* handlers without NZVC update
+int flags_dead = 0;
+int flags_set = 0; // current handler updates NZVC
+int valid_nf[0x10000];
+
+// cost and operands of handler being generated, for m68k_opcode_info
+typedef struct
+{
+	int bus_words; // accesses besides opcode fetch
+	int reads, writes; // words, instruction stream excluded
+	int delay; // internal cycles
+	int size, ea, ea_dest; // of get_ea, 3 and -1 if none
+} handler_info;
+
+handler_info info;
+handler_info *func_info = 0;
+handler_info opcode_info[0x10000];
+
+// generate whole core as one function, one label per state
+int threaded_mode = 0;
+
+// generate states returning next continuation instead of storing it
+int cont_mode = 0;
+
+// comma separated families from "compact=" option, their handlers decode
+// register fields at runtime, so one handler serves every register while
+// EA mode and size stay specialized, "all" selects every family
+const char *compact_families = 0;
+
+// opcode bits decoded at runtime by handler being generated
+int compact_regs = 0;
+
+// opcodes covering PROFILE_HOT percent of instructions counted in
+// "profile=" file stay fully specialized, compact handlers serve the rest
+#define PROFILE_HOT 99.0
+unsigned long long profile_count[0x10000];
+int hot[0x10000];
+int profiled = 0;
+unsigned long long hot_heat = 0; // count of least frequent hot opcode
+
+// register of EA or opcode field in bits 9-11 instead of 0-2
+#define REG_X 0x20000
+
+const char* state_macro(void)
+{
+	return (threaded_mode || cont_mode) ? "M68K_STATE" : "M68K_FUNCTION";
+}
+
 void add_opcode(int func_id, int opcode)
 {
 	if (func_id<0)
@@ -104,15 +166,27 @@ void add_opcode(int func_id, int opcode)
 		exit(0);
 	}
 
+	compact_regs = 0;
 	if (func_id == invalid())
 		return;
 
+	func_words[func_id] = fetch_words;
+	func_flags[func_id] = flags_set;
+	func_info[func_id] = info;
+	if (flags_dead)
+	{
+		valid_nf[opcode] = flags_set ? func_id : -1;
+		return;
+	}
+
 	if (valid[opcode] != invalid())
 	{
 		fprintf(stderr, "Error: two opcode handlers at same opcode number %04X\n", opcode);
 		exit(0);
 	}
 	valid[opcode] = func_id;
+	opcode_length[opcode] = fetch_words + 1;
+	opcode_info[opcode] = info;
 }
 
 void hash_init(void)
@@ -175,7 +249,10 @@ int declare_function(const char* name)
 
 	++func_count;
 	func_names = (char**)realloc(func_names, func_count * sizeof(char*));
-	if (!func_names)
+	func_words = (int*)realloc(func_words, func_count * sizeof(int));
+	func_flags = (int*)realloc(func_flags, func_count * sizeof(int));
+	func_info = (handler_info*)realloc(func_info, func_count * sizeof(handler_info));
+	if (!func_names || !func_words || !func_flags || !func_info)
 		return -1;
 
 	func_names[func_count - 1] = (char*)malloc(strlen(name) + 1);
@@ -187,37 +264,173 @@ int declare_function(const char* name)
 	return func_count - 1;
 }
 
+void strconcat(char *buffer, const char *a, const char *b, size_t max_len)
+{
+	int la, lb;
+	la = strlen(a);
+	lb = strlen(b);
+	if (la + lb >= max_len)
+		fprintf(stderr, "Error: max length overflow at concat: %s%s\n", a, b);
+	strcpy(buffer, a);
+	strcpy(buffer+la, b);
+}
+
 int begin_function(const char* name)
 {
-	int func_id = declare_function(name);
+	char nf_name[MAX_NAME];
+	int func_id;
+
+	if (flags_dead)
+	{
+		strconcat(nf_name, "nf_", name, MAX_NAME);
+		name = nf_name;
+	}
+
+	func_id = declare_function(name);
+	if (func_id >= 0)
+	{
+		if (fast_mode)
+		{
+			fetch_words = 0;
+			flags_set = 0;
+			memset(&info, 0, sizeof(info));
+			info.size = 3;
+			info.ea = info.ea_dest = -1;
+			fprintf(out, "M68K_FAST_FUNCTION(fast_%s)\n{\n\tuint32_t cycles = 0;\n", name);
+		}
+		else
+			fprintf(out, "%s(%s)\n{\n", state_macro(), name);
+	}
+	return func_id;
+}
+
+// mnemonic is listed in compact_families
+int is_compact(const char *mnemonic)
+{
+	const char *p = compact_families;
+	int len = strlen(mnemonic);
+
+	while (p)
+	{
+		if ((!strncmp(p, mnemonic, len) && (p[len] == ',' || !p[len]))
+		 || (!strncmp(p, "all", 3) && (p[3] == ',' || !p[3])))
+			return 1;
+		p = strchr(p, ',');
+		if (p)
+			++p;
+	}
+	return 0;
+}
+
+// name of handler, fields are opcode bits of registers decoded at runtime
+// if family is compact, returns id of already generated handler sharing
+// that name or -1 if it's to be generated
+int compact_function(char *func_name, const char *mnemonic, int opcode, int fields)
+{
+	char nf_name[MAX_NAME];
+	const char *name = func_name;
+	int func_id;
+
+	if (!fields || !is_compact(mnemonic) || hot[opcode])
+	{
+		sprintf(func_name, "%s_%04X", mnemonic, opcode);
+		return -1;
+	}
+
+	compact_regs = fields;
+	sprintf(func_name, "%s_r%04X", mnemonic, opcode & ~fields);
+	if (flags_dead)
+	{
+		strconcat(nf_name, "nf_", func_name, MAX_NAME);
+		name = nf_name;
+	}
+
+	func_id = func_by_name(name);
 	if (func_id >= 0)
-		printf("M68K_FUNCTION(%s)\n{\n", name);
+	{
+		fetch_words = func_words[func_id];
+		flags_set = func_flags[func_id];
+		info = func_info[func_id];
+	}
 	return func_id;
 }
 
+// register is decoded at runtime, REG_X tells it's at bits 9-11 of opcode
+int reg_compact(int reg)
+{
+	return compact_regs & ((reg & REG_X) ? 0x0E00 : 0x0007);
+}
+
+// register number as C expression
+const char *reg_name(int reg)
+{
+	static char buffer[4][8];
+	static int n = 0;
+	char *s;
+
+	if (reg_compact(reg))
+		return (reg & REG_X) ? "OPCODE_RX" : "OPCODE_RY";
+
+	s = buffer[n++ & 3];
+	sprintf(s, "%d", reg&7);
+	return s;
+}
+
+// index of Dn or An register of EA for SET_DN_REG, An follow Dn
+const char *dn_reg_name(int ea)
+{
+	static char buffer[4][16];
+	static int n = 0;
+	char *s;
+
+	if (!(ea & 8))
+		return reg_name(ea);
+
+	s = buffer[n++ & 3];
+	if (reg_compact(ea))
+		sprintf(s, "8+%s", reg_name(ea));
+	else
+		sprintf(s, "%d", ea&0xF);
+	return s;
+}
+
 void end_function()
 {
-	printf("}\n\n");
+	fprintf(out, "}\n\n");
 }
 
-void strconcat(char *buffer, const char *a, const char *b, size_t max_len)
+// NZVC update, left out of flags-dead handlers
+void print_flags(const char *format, ...)
 {
-	int la, lb;
-	la = strlen(a);
-	lb = strlen(b);
-	if (la + lb >= max_len)
-		fprintf(stderr, "Error: max length overflow at concat: %s%s\n", a, b);
-	strcpy(buffer, a);
-	strcpy(buffer+la, b);
+	va_list args;
+
+	flags_set = 1;
+	if (flags_dead)
+		return;
+
+	va_start(args, format);
+	vfprintf(out, format, args);
+	va_end(args);
 }
 
 int print_bus_wait(const char* bus_wait, const char* bus_access)
 {
-	int bw = declare_function(bus_wait);
+	int bw;
+
+	++info.bus_words;
+
+	// fast handler just counts bus access time and keeps going
+	if (fast_mode)
+	{
+		fprintf(out, "\tcycles += READ_WAIT_TIME;\n");
+		return 0;
+	}
 
-	printf("\tWAIT_BUS(%s, %s);\n}\n\n", bus_wait, bus_access);
+	bw = declare_function(bus_wait);
+
+	fprintf(out, "\tWAIT_BUS(%s, %s);\n}\n\n", bus_wait, bus_access);
 	if (bw >= 0)
-		printf("M68K_FUNCTION(%s) { WAIT_BUS(%s, %s); }\n\n", bus_wait, bus_wait, bus_access);
+		fprintf(out, "%s(%s) { WAIT_BUS(%s, %s); }\n\n", state_macro(), bus_wait, bus_wait, bus_access);
 
 	return begin_function(bus_access);
 }
@@ -244,23 +457,24 @@ int print_bus_read(const char* prefix, const char* address, const char* lval, in
 	if (r < 0)
 		return r;
 
+	info.reads += size == 2 ? 2 : 1;
 	switch (size)
 	{
 		case 0:
-			printf("\t%s = READ_8(%s);\n", lval, address);
+			fprintf(out, "\t%s = READ_8(%s);\n", lval, address);
 			break;
 
 		case 1:
-			printf("\t%s = READ_16(%s);\n", lval, address);
+			fprintf(out, "\t%s = READ_16(%s);\n", lval, address);
 			break;
 
 		case 2:
-			printf("\t%s = READ_16(%s)<<16;\n", lval, address);
+			fprintf(out, "\t%s = READ_16(%s)<<16;\n", lval, address);
 
 			if (WAIT_BUS("_wait2", "_read2") < 0)
 				fprintf(stderr, "Error: %s_read2 already exists\n", prefix);
 
-			printf("\t%s |= READ_16(%s + 2);\n", lval, address);
+			fprintf(out, "\t%s |= READ_16(%s + 2);\n", lval, address);
 			break;
 
 		default:
@@ -290,23 +504,24 @@ int print_bus_write(const char* prefix, const char* address, const char* val, in
 	if (r < 0)
 		return r;
 
+	info.writes += size == 2 ? 2 : 1;
 	switch (size)
 	{
 		case 0:
-			printf("\tWRITE_8(%s, %s);\n", address, val);
+			fprintf(out, "\tWRITE_8(%s, %s);\n", address, val);
 			break;
 
 		case 1:
-			printf("\tWRITE_16(%s, %s);\n", address, val);
+			fprintf(out, "\tWRITE_16(%s, %s);\n", address, val);
 			break;
 
 		case 2:
-			printf("\tWRITE_16(%s, (%s)>>16);\n", address, val);
+			fprintf(out, "\tWRITE_16(%s, (%s)>>16);\n", address, val);
 
 			if (WAIT_BUS("_wait2", "_write2") < 0)
 				fprintf(stderr, "Error: %s_read2 already exists\n", prefix);
 
-			printf("\tWRITE_16(%s + 2, %s);\n", address, val);
+			fprintf(out, "\tWRITE_16(%s + 2, %s);\n", address, val);
 			break;
 
 		default:
@@ -339,28 +554,32 @@ int print_bus_fetch(const char* prefix, const char* lval, int size)
 	switch (size)
 	{
 		case 0:
-			printf("\t%s = (uint8_t)READ_16(PC);\n", lval);
+			fprintf(out, "\t%s = (uint8_t)FETCH_16(PC);\n", lval);
+			++fetch_words;
 			break;
 
 		case 1:
-			printf("\t%s = READ_16(PC);\n", lval);
+			fprintf(out, "\t%s = FETCH_16(PC);\n", lval);
+			++fetch_words;
 			break;
 
 		case 2:
-			printf("\t%s = READ_16(PC)<<16;\n", lval);
-			printf("\tPC += 2;\n");
+			fprintf(out, "\t%s = FETCH_16(PC)<<16;\n", lval);
+			++fetch_words;
+			fprintf(out, "\tPC += 2;\n");
 
 			if (WAIT_BUS("_wait2", "_read2") < 0)
 				fprintf(stderr, "Error: %s_read2 already exists\n", prefix);
 
-			printf("\t%s |= READ_16(PC);\n", lval);
+			fprintf(out, "\t%s |= FETCH_16(PC);\n", lval);
+			++fetch_words;
 			break;
 
 		default:
 			fprintf(stderr, "Error: invalid bus fetch size %d in %s\n", size, prefix);
 			break;
 	}
-	printf("\tPC += 2;\n");
+	fprintf(out, "\tPC += 2;\n");
 	return r;
 }
 
@@ -374,6 +593,63 @@ int print_bus_fetch_(const char *func, const char *str, const char* val, int siz
 #define FETCH_BUS(str, lval, size) \
 print_bus_fetch_(func_name, str, lval, size)
 
+int print_delay(const char *func, const char *str, int time)
+{
+	char wait_name[MAX_NAME];
+
+	info.delay += time;
+	if (fast_mode)
+	{
+		fprintf(out, "\tcycles += %d;\n", time);
+		return 0;
+	}
+
+	strconcat(wait_name, func, str, MAX_NAME);
+	fprintf(out, "\tTIMEOUT(%d, %s);\n}\n\n", time, wait_name);
+
+	return begin_function(wait_name);
+}
+
+#define DELAY(str, time) \
+print_delay(func_name, str, time)
+
+// same for time known at runtime only, left out of m68k_opcode_info
+int print_delay_var(const char *func, const char *str, const char *time)
+{
+	char wait_name[MAX_NAME];
+
+	if (fast_mode)
+	{
+		fprintf(out, "\tcycles += %s;\n", time);
+		return 0;
+	}
+
+	strconcat(wait_name, func, str, MAX_NAME);
+	fprintf(out, "\tTIMEOUT(%s, %s);\n}\n\n", time, wait_name);
+
+	return begin_function(wait_name);
+}
+
+#define DELAY_VAR(str, time) \
+print_delay_var(func_name, str, time)
+
+void print_done_write(int op_size)
+{
+	if (fast_mode)
+	{
+		print_bus_write("done", "EA", "EV", op_size);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
+		return;
+	}
+
+	switch(op_size)
+	{
+		case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
+		case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
+		case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
+	}
+}
+
 void opcode_read()
 {
 	char* func_name = "opcode";
@@ -381,7 +657,85 @@ void opcode_read()
 	if (FETCH_BUS("", "m68k->opcode", 1) < 0)
 		return;
 
-	printf("\tm68k_opcode_table[m68k->opcode](m68k);\n}\n\n");
+	fprintf(out, "\tDECODE_OPCODE;\n}\n\n");
+}
+
+// final write of result, shared by all opcodes
+void done_write(const char *size, const char *write)
+{
+	char wait_name[MAX_NAME];
+	char access_name[MAX_NAME];
+
+	sprintf(wait_name, "done_wait_w%s", size);
+	sprintf(access_name, "done_write_w%s", size);
+
+	declare_function(wait_name);
+	fprintf(out, "%s(%s) { WAIT_BUS(%s, %s); }\n\n", state_macro(), wait_name, wait_name, access_name);
+
+	begin_function(access_name);
+	fprintf(out, "%s", write);
+	fprintf(out, "}\n\n");
+}
+
+void done_states()
+{
+	done_write("b", "\tWRITE_8(EA, EV);\n\tFETCH_OPCODE;\n");
+	done_write("w", "\tWRITE_16(EA, EV);\n\tFETCH_OPCODE;\n");
+	done_write("l", "\tWRITE_16(EA, EV>>16);\n\tWAIT_BUS(done_wait_wl2, done_write_wl2);\n");
+	done_write("l2", "\tWRITE_16(EA + 2, EV);\n\tFETCH_OPCODE;\n");
+}
+
+// goes to state more while movem mask in low word of OP isn't empty
+void print_movem_next(const char *more, const char *done)
+{
+	fprintf(out, "\tif ((uint16_t)OP)\n\t{\n");
+	fprintf(out, "\t\tWAIT_BUS(movem_wait_%s, movem_%s);\n", more, more);
+	fprintf(out, "\t}\n\telse\n\t{\n%s\t}\n", done);
+}
+
+// one word of movem per state, shared by all opcodes. high word of OP is
+// index of An updated at end, 0 if none
+void movem_state(const char *name, const char *access, const char *more, const char *done)
+{
+	char wait_name[MAX_NAME];
+	char access_name[MAX_NAME];
+
+	sprintf(wait_name, "movem_wait_%s", name);
+	sprintf(access_name, "movem_%s", name);
+
+	declare_function(wait_name);
+	fprintf(out, "%s(%s) { WAIT_BUS(%s, %s); }\n\n", state_macro(), wait_name, wait_name, access_name);
+
+	begin_function(access_name);
+	fprintf(out, "%s", access);
+	if (done)
+	{
+		fprintf(out, "\tOP &= OP - 1;\n");
+		print_movem_next(more, done);
+	}
+	else if (more)
+		fprintf(out, "\tWAIT_BUS(movem_wait_%s, movem_%s);\n", more, more);
+	fprintf(out, "}\n\n");
+}
+
+// registers go from D0 up, from A7 down for -(An), extra read ends
+// memory to register transfer
+void movem_states()
+{
+	const char *fetch = "\t\tFETCH_OPCODE;\n";
+	const char *update = "\t\tm68k->reg[OP>>16] = EA;\n\t\tFETCH_OPCODE;\n";
+	const char *extra = "\t\tWAIT_BUS(movem_wait_rd, movem_rd);\n";
+
+	movem_state("ww", "\tWRITE_16(EA, m68k->reg[LOWEST_BIT(OP)]);\n\tEA += 2;\n", "ww", fetch);
+	movem_state("wl", "\tWRITE_16(EA, m68k->reg[LOWEST_BIT(OP)]>>16);\n\tEA += 2;\n", "wl2", 0);
+	movem_state("wl2", "\tWRITE_16(EA, m68k->reg[LOWEST_BIT(OP)]);\n\tEA += 2;\n", "wl", fetch);
+	movem_state("pw", "\tEA -= 2;\n\tWRITE_16(EA, m68k->reg[15 - LOWEST_BIT(OP)]);\n", "pw", update);
+	movem_state("pl", "\tEA -= 2;\n\tWRITE_16(EA, m68k->reg[15 - LOWEST_BIT(OP)]);\n", "pl2", 0);
+	movem_state("pl2", "\tEA -= 2;\n\tWRITE_16(EA, m68k->reg[15 - LOWEST_BIT(OP)]>>16);\n", "pl", update);
+	movem_state("rw", "\tm68k->reg[LOWEST_BIT(OP)] = (int16_t)READ_16(EA);\n\tEA += 2;\n", "rw", extra);
+	movem_state("rl", "\tEV = READ_16(EA)<<16;\n\tEA += 2;\n", "rl2", 0);
+	movem_state("rl2", "\tm68k->reg[LOWEST_BIT(OP)] = EV | READ_16(EA);\n\tEA += 2;\n", "rl", extra);
+	movem_state("rd", "\t(void)READ_16(EA);\n\tif (OP>>16)\n\t\tm68k->reg[OP>>16] = EA;\n\tFETCH_OPCODE;\n", 0, 0);
 }
 
 void reset_exception()
@@ -390,15 +744,15 @@ void reset_exception()
 
 	begin_function(func_name);
 
-	printf("\tif (!SUPERVISOR) USP = SP;\n");
+	fprintf(out, "\tif (!SUPERVISOR) USP = SP;\n");
 
 	READ_BUS("", "0", "REG_A(7)", 2);
 
 	READ_BUS("_pc", "4", "PC", 2);
 
-	printf("\tSR = M68K_FLAG_S_MASK | M68K_FLAG_I0_MASK | M68K_FLAG_I1_MASK | M68K_FLAG_I2_MASK;\n");
+	fprintf(out, "\tSR = M68K_FLAG_S_MASK | M68K_FLAG_I0_MASK | M68K_FLAG_I1_MASK | M68K_FLAG_I2_MASK;\n");
 
-	printf("\tif (PC&1) ADDRESS_EXCEPTION;\n");
+	fprintf(out, "\tif (PC&1) ADDRESS_EXCEPTION;\n");
 	opcode_read();
 }
 
@@ -408,9 +762,9 @@ void address_exception()
 
 	begin_function(func_name);
 
-	printf("\tif (!SUPERVISOR) {USP = SP; SP = SSP;}\n");
+	fprintf(out, "\tif (!SUPERVISOR) {USP = SP; SP = SSP;}\n");
 
-	printf("\tif (SP&1) HALT;\n");
+	fprintf(out, "\tif (SP&1) HALT;\n");
 
 	WRITE_BUS("_pcl", "SP-2", "PC", 1);
 	WRITE_BUS("_sr" , "SP-6", "SR", 1);
@@ -422,9 +776,9 @@ void address_exception()
 
 	READ_BUS("_vec", "12", "PC", 2);
 
-	printf("\tif (PC&1) HALT;\n");
-	printf("\tSR = (SR | M68K_FLAG_S_MASK) & (~M68K_FLAG_T1_MASK);\n");
-	printf("\tSP -= 14;\n");
+	fprintf(out, "\tif (PC&1) HALT;\n");
+	fprintf(out, "\tSR = (SR | M68K_FLAG_S_MASK) & (~M68K_FLAG_T1_MASK);\n");
+	fprintf(out, "\tSP -= 14;\n");
 
 	opcode_read();
 }
@@ -435,9 +789,35 @@ void interrupt()
 
 	begin_function(func_name);
 
-	printf("\tif (!SUPERVISOR) {USP = SP; SP = SSP;}\n");
+	fprintf(out, "\tif (!SUPERVISOR) {USP = SP; SP = SSP;}\n");
+
+	fprintf(out, "\tif (SP&1) HALT;\n");
+
+	WRITE_BUS("_pcl", "SP-2", "PC", 1);
+	WRITE_BUS("_sr" , "SP-6", "SR", 1);
+	WRITE_BUS("_pch", "SP-4", "PC>>16", 1);
+
+	READ_BUS("_vec", "OP*4", "PC", 2);
+
+	// OP is autovector of level, see m68k_interrupt
+	fprintf(out, "\tSR = (SR | M68K_FLAG_S_MASK) & (~M68K_FLAG_T1_MASK) & (~M68K_FLAG_I_MASK);\n");
+	fprintf(out, "\tSR |= (OP - M68K_AUTOVECTOR) << M68K_FLAG_I0_BIT;\n");
+	fprintf(out, "\tSP -= 6;\n");
+	fprintf(out, "\tif (PC&1) ADDRESS_EXCEPTION;\n");
+
+	opcode_read();
+}
+
+// group 2 exception, vector is OP
+void trap_exception()
+{
+	const char* func_name = "trap_exception";
+
+	begin_function(func_name);
+
+	fprintf(out, "\tif (!SUPERVISOR) {USP = SP; SP = SSP;}\n");
 
-	printf("\tif (SP&1) HALT;\n");
+	fprintf(out, "\tif (SP&1) HALT;\n");
 
 	WRITE_BUS("_pcl", "SP-2", "PC", 1);
 	WRITE_BUS("_sr" , "SP-6", "SR", 1);
@@ -445,9 +825,9 @@ void interrupt()
 
 	READ_BUS("_vec", "OP*4", "PC", 2);
 
-	printf("\tSR = (SR | M68K_FLAG_S_MASK) & (~M68K_FLAG_T1_MASK);\n");
-	printf("\tSP -= 6;\n");
-	printf("\tif (PC&1) ADDRESS_EXCEPTION;\n");
+	fprintf(out, "\tSR = (SR | M68K_FLAG_S_MASK) & (~M68K_FLAG_T1_MASK);\n");
+	fprintf(out, "\tSP -= 6;\n");
+	fprintf(out, "\tif (PC&1) ADDRESS_EXCEPTION;\n");
 
 	opcode_read();
 }
@@ -459,7 +839,14 @@ int invalid(void)
 
 int get_ea(const char *func_name, int opcode, int op_size, int read)
 {
-	char wait_name[MAX_NAME];
+	const char *reg = reg_name(opcode);
+	char base[16];
+
+	if (opcode & REG_X)
+		info.ea_dest = ea_mode(opcode);
+	else
+		info.ea = ea_mode(opcode);
+	info.size = op_size;
 
 	switch(ea_mode(opcode))
 	{
@@ -467,97 +854,103 @@ int get_ea(const char *func_name, int opcode, int op_size, int read)
 			return -1;
 
 		case 0: // Dn
-			printf("\tEV = REG_D(%d);\n", opcode&7);
+			fprintf(out, "\tEV = REG_D(%s);\n", reg);
 			break;
 
 		case 1: // An
-			printf("\tEV = REG_A(%d);\n", opcode&7);
+			fprintf(out, "\tEV = REG_A(%s);\n", reg);
 			break;
 
 		case 2: // (An)
-			printf("\tEA = REG_A(%d);\n", opcode&7);
+			fprintf(out, "\tEA = REG_A(%s);\n", reg);
 			break;
 
 		case 3: // (An)+
-			printf("\tEA = REG_A(%d);\n", opcode&7);
-			if (op_size == 0 && (opcode&7) == 7) // sp
-				printf("\tREG_A(7) += 2;\n");
+			fprintf(out, "\tEA = REG_A(%s);\n", reg);
+			if (op_size == 0 && reg_compact(opcode)) // sp is known at runtime
+				fprintf(out, "\tREG_A(%s) += 1 + (%s == 7);\n", reg, reg);
+			else if (op_size == 0 && (opcode&7) == 7) // sp
+				fprintf(out, "\tREG_A(7) += 2;\n");
 			else
-				printf("\tREG_A(%d) += %d;\n", opcode&7, 1<<op_size);
+				fprintf(out, "\tREG_A(%s) += %d;\n", reg, 1<<op_size);
 			break;
 
 		case 4: // -(An)
 			if (read) // timing fix
-			{
-				sprintf(wait_name, "%s_wait_pre", func_name);
-				printf("\tTIMEOUT(2, %s);\n}\n\n", wait_name);
-
-				begin_function(wait_name);
-			}
+				DELAY("_wait_pre", 2);
 
-			if (op_size == 0 && (opcode&7) == 7) // sp
-				printf("\tREG_A(7) -= 2;\n");
+			if (op_size == 0 && reg_compact(opcode)) // sp is known at runtime
+				fprintf(out, "\tREG_A(%s) -= 1 + (%s == 7);\n", reg, reg);
+			else if (op_size == 0 && (opcode&7) == 7) // sp
+				fprintf(out, "\tREG_A(7) -= 2;\n");
 			else
-				printf("\tREG_A(%d) -= %d;\n", opcode&7, 1<<op_size);
-			printf("\tEA = REG_A(%d);\n", opcode&7);
+				fprintf(out, "\tREG_A(%s) -= %d;\n", reg, 1<<op_size);
+			fprintf(out, "\tEA = REG_A(%s);\n", reg);
 			break;
 
 		case 5: // (d16,An)
 		case 9: // (d16,pc)
 			WAIT_BUS("_wait_d16", "_read_d16");
 
-			printf("\tEA = (int16_t)READ_16(PC) + ");
+			fprintf(out, "\tEA = (int16_t)FETCH_16(PC) + ");
+			++fetch_words;
 			if (ea_mode(opcode) == 5)
-				printf("REG_A(%d);\n", opcode&7);
+				fprintf(out, "REG_A(%s);\n", reg);
 			else
-				printf("PC;\n");
+				fprintf(out, "PC;\n");
 
-			printf("\tPC += 2;\n");
+			fprintf(out, "\tPC += 2;\n");
 			break;
 
 		case 6: // (d8,An,xn)
 		case 10: // (d8,pc,xn)
 			WAIT_BUS("_wait_d8", "_read_d8");
 
-			printf("\tEA = READ_16(PC);\n");
+			fprintf(out, "\tEA = FETCH_16(PC);\n");
+			++fetch_words;
 
-			sprintf(wait_name, "%s_wait_d8_sum", func_name);
-			printf("\tTIMEOUT(2, %s);\n}\n\n", wait_name);
-
-			begin_function(wait_name);
-			printf(
+			DELAY("_wait_d8_sum", 2);
+			if (ea_mode(opcode) == 10)
+				strcpy(base, "PC");
+			else if (reg_compact(opcode))
+				sprintf(base, "A0+%s", reg);
+			else
+				sprintf(base, "A%s", reg);
+			fprintf(out, 
 "	if (EA & 0x800)\n"
 "		EA = (uint32_t)(int8_t)EA\n"
-"							+m68k->reg[M68K_REG_%c%c]\n"
+"							+m68k->reg[M68K_REG_%s]\n"
 "							+REG_D((EA>>12)&0xF);\n"
 "	else\n"
 "		EA = (uint32_t)(int8_t)EA\n"
-"							+m68k->reg[M68K_REG_%c%c]\n"
+"							+m68k->reg[M68K_REG_%s]\n"
 "							+(int16_t)REG_D((EA>>12)&0xF);\n"
 "	PC += 2;\n"
-	, ea_mode(opcode)==6?'A':'P', ea_mode(opcode)==6?'0'+(opcode&7):'C',
-	  ea_mode(opcode)==6?'A':'P', ea_mode(opcode)==6?'0'+(opcode&7):'C');
+	, base, base);
 
 			break;
 
 		case 7: // (xxx).W
 			WAIT_BUS("_wait_w", "_read_w");
 
-			printf("\tEA = (int16_t)READ_16(PC);\n");
-			printf("\tPC += 2;\n");
+			fprintf(out, "\tEA = (int16_t)FETCH_16(PC);\n");
+			++fetch_words;
+			fprintf(out, "\tPC += 2;\n");
 
 			break;
 
 		case 8: // (xxx).L
 			WAIT_BUS("_wait_l", "_read_l");
 
-			printf("\tEA = READ_16(PC)<<16;\n");
-			printf("\tPC += 2;\n");
+			fprintf(out, "\tEA = FETCH_16(PC)<<16;\n");
+			++fetch_words;
+			fprintf(out, "\tPC += 2;\n");
 
 			WAIT_BUS("_wait_l2", "_read_l2");
 
-			printf("\tEA |= (uint16_t)READ_16(PC);\n");
-			printf("\tPC += 2;\n");
+			fprintf(out, "\tEA |= (uint16_t)FETCH_16(PC);\n");
+			++fetch_words;
+			fprintf(out, "\tPC += 2;\n");
 
 			break;
 
@@ -580,7 +973,9 @@ int gen_immediate(const char *mnemonic, int opcode, opcode_handler handler)
 	if (handler(check(opcode)) < 0)
 		return invalid();
 
-	sprintf(func_name, "%s_%04X", mnemonic, opcode);
+	func_id = compact_function(func_name, mnemonic, opcode, ea_mode(opcode) < 7 ? 0x0007 : 0);
+	if (func_id >= 0)
+		return func_id;
 
 	func_id = begin_function(func_name);
 
@@ -593,7 +988,7 @@ int gen_immediate(const char *mnemonic, int opcode, opcode_handler handler)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
 		sprintf(func_name, "%s_common_%d", mnemonic, op_size);
 
@@ -605,24 +1000,19 @@ int gen_immediate(const char *mnemonic, int opcode, opcode_handler handler)
 		return -1;
 	if ((opcode & 0xFF00) == 0xC00) // cmpi
 	{
-		printf("\t}\n\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t}\n\tFETCH_OPCODE;\n}\n\n");
 		return func_id;
 	}
 	if (ea_mode(opcode) < 2)
 	{
-		printf("\t\tSET_DN_REG%d(%d, result);\n\t}\n", 8<<op_size, opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG%d(%s, result);\n\t}\n", 8<<op_size, dn_reg_name(opcode));
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\t\tEV = result;\n\t}\n");
+		fprintf(out, "\t\tEV = result;\n\t}\n");
 
-		switch(op_size)
-		{
-			case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
-			case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
-			case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
-		}
+		print_done_write(op_size);
 	}
 	return func_id;
 }
@@ -638,11 +1028,8 @@ int ori_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV | OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV | OP);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -665,11 +1052,8 @@ int andi_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV & OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV & OP);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -692,12 +1076,9 @@ int subi_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV - OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_C_FLAG((uint%d_t)EV < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_X_FLAG((uint%d_t)EV < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_V_FLAG%d(EV, -OP, result);\n", 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV - OP);\n", 8<<op_size, 8<<op_size);
+	fprintf(out, "\t\tSET_X_FLAG((uint%d_t)EV < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_SUB(%d, OP, EV, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -720,12 +1101,9 @@ int addi_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV + OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_C_FLAG((uint%d_t)result < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_X_FLAG((uint%d_t)result < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_V_FLAG%d(EV, OP, result);\n", 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV + OP);\n", 8<<op_size, 8<<op_size);
+	fprintf(out, "\t\tSET_X_FLAG((uint%d_t)result < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_ADD(%d, OP, EV, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -748,11 +1126,8 @@ int eori_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV ^ OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV ^ OP);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -775,11 +1150,12 @@ int cmpi_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV - OP);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG%d(EV, -OP, result);\n", 8<<op_size);
-	printf("\t\tSET_C_FLAG((uint%d_t)EV < (uint%d_t)OP?1:0);\n", 8<<op_size, 8<<op_size);
+	// result is only seen through flags
+	if (flags_dead)
+		fprintf(out, "\t{\n");
+	else
+		fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV - OP);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_SUB(%d, OP, EV, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -804,12 +1180,14 @@ int gen_bit(const char *mnemonic, int opcode, opcode_handler handler)
 	type = (opcode&0x100);
 	dn = (opcode>>9)&7;
 
-	sprintf(func_name, "%s_%04X", mnemonic, opcode);
+	func_id = compact_function(func_name, mnemonic, opcode, (ea_mode(opcode) < 7 ? 0x0007 : 0) | (type ? 0x0E00 : 0));
+	if (func_id >= 0)
+		return func_id;
 
 	func_id = begin_function(func_name);
 
 	if (type)
-		printf("\tOP = REG_D(%d);\n", dn);
+		fprintf(out, "\tOP = REG_D(%s);\n", reg_name(dn|REG_X));
 	else
 		FETCH_BUS("", "OP", 0);
 
@@ -828,18 +1206,18 @@ int gen_bit(const char *mnemonic, int opcode, opcode_handler handler)
 		return -1;
 	if ((opcode & 0xF0C0) == 0) // btst
 	{
-		printf("\t}\n\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t}\n\tFETCH_OPCODE;\n}\n\n");
 		return func_id;
 	}
 	if (ea_mode(opcode) < 2)
 	{
-		printf("\t\tSET_DN_REG32(%d, result);\n\t}\n", opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG32(%s, result);\n\t}\n", dn_reg_name(opcode));
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\t\tEV = result;\n\t}\n");
-		print_bus_wait("done_wait_wb", "done_write_wb");
+		fprintf(out, "\t\tEV = result;\n\t}\n");
+		print_done_write(0);
 	}
 	return func_id;
 }
@@ -856,11 +1234,11 @@ int btst_handler(int opcode)
 		return 0;
 
 	if (ea_address(opcode))
-		printf("\t{\n\t\tuint8_t result = ((~EV)>>(OP&7))&1;\n");
+		fprintf(out, "\t{\n\t\tuint8_t result = ((~EV)>>(OP&7))&1;\n");
 	else
-		printf("\t{\n\t\tuint32_t result = ((~EV)>>(OP&31))&1;\n");
+		fprintf(out, "\t{\n\t\tuint32_t result = ((~EV)>>(OP&31))&1;\n");
 
-	printf("\t\tSET_Z_FLAG(result);\n");
+	fprintf(out, "\t\tSET_Z_FLAG(result);\n");
 	return 0;
 }
 
@@ -885,13 +1263,13 @@ int bchg_handler(int opcode)
 
 	if (ea_address(opcode))
 	{
-		printf("\t{\n\t\tuint8_t result = EV^(1<<(OP&7));\n");
-		printf("\t\tSET_Z_FLAG((result>>(OP&7))&1);\n");
+		fprintf(out, "\t{\n\t\tuint8_t result = EV^(1<<(OP&7));\n");
+		fprintf(out, "\t\tSET_Z_FLAG((result>>(OP&7))&1);\n");
 	}
 	else
 	{
-		printf("\t{\n\t\tuint32_t result = EV^(1<<(OP&31));\n");
-		printf("\t\tSET_Z_FLAG((result>>(OP&31))&1);\n");
+		fprintf(out, "\t{\n\t\tuint32_t result = EV^(1<<(OP&31));\n");
+		fprintf(out, "\t\tSET_Z_FLAG((result>>(OP&31))&1);\n");
 	}
 	return 0;
 }
@@ -917,13 +1295,13 @@ int bclr_handler(int opcode)
 
 	if (ea_address(opcode))
 	{
-		printf("\t{\n\t\tuint8_t result = EV&(~(1<<(OP&7)));\n");
-		printf("\t\tSET_Z_FLAG(((~EV)>>(OP&7))&1);\n");
+		fprintf(out, "\t{\n\t\tuint8_t result = EV&(~(1<<(OP&7)));\n");
+		fprintf(out, "\t\tSET_Z_FLAG(((~EV)>>(OP&7))&1);\n");
 	}
 	else
 	{
-		printf("\t{\n\t\tuint32_t result = EV&(~(1<<(OP&31)));\n");
-		printf("\t\tSET_Z_FLAG(((~EV)>>(OP&31))&1);\n");
+		fprintf(out, "\t{\n\t\tuint32_t result = EV&(~(1<<(OP&31)));\n");
+		fprintf(out, "\t\tSET_Z_FLAG(((~EV)>>(OP&31))&1);\n");
 	}
 	return 0;
 }
@@ -949,13 +1327,13 @@ int bset_handler(int opcode)
 
 	if (ea_address(opcode))
 	{
-		printf("\t{\n\t\tuint8_t result = EV|(1<<(OP&7));\n");
-		printf("\t\tSET_Z_FLAG(((~EV)>>(OP&7))&1);\n");
+		fprintf(out, "\t{\n\t\tuint8_t result = EV|(1<<(OP&7));\n");
+		fprintf(out, "\t\tSET_Z_FLAG(((~EV)>>(OP&7))&1);\n");
 	}
 	else
 	{
-		printf("\t{\n\t\tuint32_t result = EV|(1<<(OP&31));\n");
-		printf("\t\tSET_Z_FLAG(((~EV)>>(OP&31))&1);\n");
+		fprintf(out, "\t{\n\t\tuint32_t result = EV|(1<<(OP&31));\n");
+		fprintf(out, "\t\tSET_Z_FLAG(((~EV)>>(OP&31))&1);\n");
 	}
 	return 0;
 }
@@ -978,7 +1356,9 @@ int gen_unary(const char *mnemonic, int opcode, opcode_handler handler)
 	if (handler(check(opcode)) < 0)
 		return invalid();
 
-	sprintf(func_name, "%s_%04X", mnemonic, opcode);
+	func_id = compact_function(func_name, mnemonic, opcode, ea_mode(opcode) < 7 ? 0x0007 : 0);
+	if (func_id >= 0)
+		return func_id;
 
 	func_id = begin_function(func_name);
 
@@ -988,7 +1368,7 @@ int gen_unary(const char *mnemonic, int opcode, opcode_handler handler)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
 		sprintf(func_name, "%s_common_%d", mnemonic, op_size);
 
@@ -1000,24 +1380,21 @@ int gen_unary(const char *mnemonic, int opcode, opcode_handler handler)
 		return -1;
 	if ((opcode & 0xFF00) == 0x4A00) // tst
 	{
-		printf("\t}\n\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t}\n\tFETCH_OPCODE;\n}\n\n");
 		return func_id;
 	}
 	if (ea_mode(opcode) < 2)
 	{
-		printf("\t\tSET_DN_REG%d(%d, result);\n\t}\n", 8<<op_size, opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG%d(%s, result);\n\t}\n", 8<<op_size, dn_reg_name(opcode));
+		if ((opcode & 0xFFC0) == 0x4800) // nbcd
+			DELAY("_bcd", 2);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\t\tEV = result;\n\t}\n");
+		fprintf(out, "\t\tEV = result;\n\t}\n");
 
-		switch(op_size)
-		{
-			case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
-			case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
-			case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
-		}
+		print_done_write(op_size);
 	}
 	return func_id;
 }
@@ -1033,12 +1410,12 @@ int negx_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(0 - EV - GET_X_FLAG());\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_X_FLAG(((uint%d_t)EV != 0 || GET_X_FLAG() != 0)?1:0);\n", 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tif (result) {SET_Z_FLAG(0);}\n");
-	printf("\t\tSET_V_FLAG((uint%d_t)result == (1<<(%d-1))?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_C_FLAG(((uint%d_t)EV != 0 || GET_X_FLAG() != 0)?1:0);\n", 8<<op_size);
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(0 - EV - GET_X_FLAG());\n", 8<<op_size, 8<<op_size);
+	fprintf(out, "\t\tSET_X_FLAG(((uint%d_t)EV != 0 || GET_X_FLAG() != 0)?1:0);\n", 8<<op_size);
+	fprintf(out, "\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
+	fprintf(out, "\t\tif (result) {SET_Z_FLAG(0);}\n");
+	fprintf(out, "\t\tSET_V_FLAG((uint%d_t)result == (1<<(%d-1))?1:0);\n", 8<<op_size, 8<<op_size);
+	fprintf(out, "\t\tSET_C_FLAG(((uint%d_t)EV != 0 || GET_X_FLAG() != 0)?1:0);\n", 8<<op_size);
 	return 0;
 }
 
@@ -1061,11 +1438,8 @@ int clr_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = 0;\n", 8<<op_size);
-	printf("\t\tSET_N_FLAG(0);\n");
-	printf("\t\tSET_Z_FLAG(1);\n");
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t{\n\t\tuint%d_t result = 0;\n", 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -1088,12 +1462,9 @@ int neg_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(- EV);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_X_FLAG(((uint%d_t)EV != 0)?1:0);\n", 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG((uint%d_t)result == (1<<(%d-1))?1:0);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_C_FLAG(((uint%d_t)EV != 0)?1:0);\n", 8<<op_size);
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(- EV);\n", 8<<op_size, 8<<op_size);
+	fprintf(out, "\t\tSET_X_FLAG(((uint%d_t)EV != 0)?1:0);\n", 8<<op_size);
+	print_flags("\t\tFLAGS_SUB(%d, EV, 0, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -1116,11 +1487,8 @@ int not_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)(~EV);\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(~EV);\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -1144,17 +1512,37 @@ void swap(int opcode)
 
 	func_id = begin_function(func_name);
 
-	printf("\tuint32_t result = (((uint32_t)REG_D(%d))>>16)|(((uint32_t)REG_D(%d))<<16);\n", opcode&7, opcode&7);
-	printf("\tSET_N_FLAG32(result);\n");
-	printf("\tSET_Z_FLAG32(result);\n");
-	printf("\tSET_V_FLAG(0);\n");
-	printf("\tSET_C_FLAG(0);\n");
-	printf("\tSET_DN_REG32(%d, result);\n", opcode&7);
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tuint32_t result = (((uint32_t)REG_D(%d))>>16)|(((uint32_t)REG_D(%d))<<16);\n", opcode&7, opcode&7);
+	print_flags("\tFLAGS_LOGIC(32, result);\n");
+	fprintf(out, "\tSET_DN_REG32(%d, result);\n", opcode&7);
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
 
+// same as sbcd from 0
+int nbcd_handler(int opcode)
+{
+	if (!ea_alterable_na(opcode))
+		return -1;
+
+	if (is_checking(opcode))
+		return 0;
+
+	fprintf(out, "\t{\n\t\tuint32_t bcd = m68k_bcd_table[1][BCD_INDEX(0, EV)];\n");
+	fprintf(out, "\t\tuint8_t result = bcd;\n");
+	print_flags("\t\tSET_BCD_FLAGS(bcd);\n");
+	return 0;
+}
+
+void nbcd(int opcode)
+{
+	if ((opcode & 0xFFC0) != 0x4800)
+		return;
+
+	add_opcode(gen_unary("nbcd", opcode, nbcd_handler), opcode);
+}
+
 void ext(int opcode)
 {
 	char func_name[MAX_NAME];
@@ -1169,17 +1557,96 @@ void ext(int opcode)
 
 	func_id = begin_function(func_name);
 
-	printf("\tuint%d_t result = (int%d_t)REG_D(%d);\n", 8<<op_size, 8<<(op_size-1), opcode&7);
-	printf("\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\tSET_V_FLAG(0);\n");
-	printf("\tSET_C_FLAG(0);\n");
-	printf("\tSET_DN_REG%d(%d, result);\n", 8<<op_size, opcode&7);
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tuint%d_t result = (int%d_t)REG_D(%d);\n", 8<<op_size, 8<<(op_size-1), opcode&7);
+	print_flags("\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
+	fprintf(out, "\tSET_DN_REG%d(%d, result);\n", 8<<op_size, opcode&7);
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
 
+// mask is fetched before extension words of EA, fast core moves all
+// registers at once and charges 4 cycles per word
+int gen_movem(int opcode)
+{
+	char func_name[MAX_NAME];
+	int func_id, op_size, to_reg, mode;
+	const char *an;
+
+	op_size = ((opcode >> 6) & 1) + 1;
+	to_reg = opcode & 0x400;
+	mode = ea_mode(opcode);
+	if (mode < 2 || mode == 11
+	 || (to_reg && mode == 4)
+	 || (!to_reg && (mode == 3 || mode > 8)))
+		return invalid();
+
+	func_id = compact_function(func_name, "movem", opcode, mode < 7 ? 0x0007 : 0);
+	if (func_id >= 0)
+		return func_id;
+
+	func_id = begin_function(func_name);
+
+	FETCH_BUS("", "OP", 1);
+
+	an = reg_name(opcode & 7);
+	if (mode == 3 || mode == 4)
+	{
+		info.ea = mode;
+		info.size = op_size;
+		fprintf(out, "\tEA = REG_A(%s);\n", an);
+	}
+	else if (get_ea(func_name, opcode, op_size, 0) < 0)
+		return -1;
+
+	// nothing is written if mask is empty, but extra read is still done
+	if (to_reg)
+		fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
+	else
+		fprintf(out, "\tif ((EA&1) && (uint16_t)OP) ADDRESS_EXCEPTION;\n");
+
+	if (fast_mode)
+	{
+		if (to_reg)
+		{
+			fprintf(out, "\t{\n\t\tuint32_t words = m68k_movem_read(m68k, EA, OP, %d);\n", op_size);
+			fprintf(out, "\t\tcycles += (words + 1) * READ_WAIT_TIME;\n");
+			if (mode == 3)
+				fprintf(out, "\t\tREG_A(%s) = EA + words*2;\n", an);
+		}
+		else
+		{
+			fprintf(out, "\t{\n\t\tuint32_t words = m68k_movem_write(m68k, EA, OP, %d, %d);\n", op_size, mode == 4);
+			fprintf(out, "\t\tcycles += words * READ_WAIT_TIME;\n");
+			if (mode == 4)
+				fprintf(out, "\t\tREG_A(%s) = EA - words*2;\n", an);
+		}
+		fprintf(out, "\t}\n\tFETCH_OPCODE;\n}\n\n");
+		return func_id;
+	}
+
+	if ((mode == 3 || mode == 4) && reg_compact(opcode))
+		fprintf(out, "\tOP |= (M68K_REG_A0 + %s) << 16;\n", an);
+	else if (mode == 3 || mode == 4)
+		fprintf(out, "\tOP |= M68K_REG_A%s << 16;\n", an);
+	if (to_reg)
+		print_movem_next(op_size == 2 ? "rl" : "rw", "\t\tWAIT_BUS(movem_wait_rd, movem_rd);\n");
+	else if (mode == 4)
+		print_movem_next(op_size == 2 ? "pl" : "pw", "\t\tFETCH_OPCODE;\n");
+	else
+		print_movem_next(op_size == 2 ? "wl" : "ww", "\t\tFETCH_OPCODE;\n");
+	fprintf(out, "}\n\n");
+	return func_id;
+}
+
+void movem(int opcode)
+{
+	if ((opcode & 0xFB80) != 0x4880 || !(opcode & 0x38))
+		return;
+
+	add_opcode(gen_movem(opcode), opcode);
+}
+
 int tst_handler(int opcode)
 {
 	int op_size = (opcode >> 6) & 3;
@@ -1191,11 +1658,11 @@ int tst_handler(int opcode)
 	if (is_checking(opcode))
 		return 0;
 
-	printf("\t{\n\t\tuint%d_t result = (uint%d_t)EV;\n", 8<<op_size, 8<<op_size);
-	printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-	printf("\t\tSET_V_FLAG(0);\n");
-	printf("\t\tSET_C_FLAG(0);\n");
+	if (flags_dead)
+		fprintf(out, "\t{\n");
+	else
+		fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)EV;\n", 8<<op_size, 8<<op_size);
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	return 0;
 }
 
@@ -1219,7 +1686,7 @@ void nop(int opcode)
 
 	func_id = begin_function(func_name);
 
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
@@ -1237,17 +1704,30 @@ void stop(int opcode)
 
 	func_id = begin_function(func_name);
 
-	printf("\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
+	fprintf(out, "\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
 
 	FETCH_BUS("", "OP", 1);
 
 	sprintf(wait_name, "%s_inf", func_name);
-	printf("\tSR = OP & M68K_FLAG_ALL;\n");
-	printf("\tTIMEOUT(1<<15, %s);\n}\n\n", wait_name);
+	fprintf(out, "\tSR = OP & M68K_FLAG_ALL;\n");
+
+	// run loops just count timeout down until m68k_interrupt wakes CPU
+	fprintf(out, "\tm68k->stopped = 1;\n");
+
+	// stopped state lives in cycle-split core
+	if (fast_mode)
+	{
+		fprintf(out, "\tTIMEOUT(cycles + M68K_STOP_TIMEOUT, %s);\n", wait_name);
+		fprintf(out, "\treturn 0;\n}\n\n");
+		add_opcode(func_id, opcode);
+		return;
+	}
+
+	fprintf(out, "\tTIMEOUT(M68K_STOP_TIMEOUT, %s);\n}\n\n", wait_name);
 
 	begin_function(wait_name);
 
-	printf("\tTIMEOUT(1<<15, %s);\n}\n\n", wait_name);
+	fprintf(out, "\tTIMEOUT(M68K_STOP_TIMEOUT, %s);\n}\n\n", wait_name);
 
 	add_opcode(func_id, opcode);
 }
@@ -1264,19 +1744,19 @@ void rte(int opcode)
 
 	func_id = begin_function(func_name);
 
-	printf("\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
+	fprintf(out, "\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
 
 	READ_BUS("", "REG_A(7)", "OP", 1);
 
 	READ_BUS("_pc", "REG_A(7)+2", "PC", 2);
 
-	printf("\tREG_A(7) += 6;\n");
+	fprintf(out, "\tREG_A(7) += 6;\n");
 
-	printf("\tSAVE_CURRENT_STACK;\n");
-	printf("\tSR = OP & M68K_FLAG_ALL;\n");
-	printf("\tGET_CURRENT_STACK;\n");
+	fprintf(out, "\tSAVE_CURRENT_STACK;\n");
+	fprintf(out, "\tSR = OP & M68K_FLAG_ALL;\n");
+	fprintf(out, "\tGET_CURRENT_STACK;\n");
 
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
@@ -1295,8 +1775,8 @@ void rts(int opcode)
 
 	READ_BUS("", "REG_A(7)", "PC", 2);
 
-	printf("\tREG_A(7) += 4;\n");
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tREG_A(7) += 4;\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
@@ -1315,14 +1795,14 @@ void rtr(int opcode)
 
 	READ_BUS("", "REG_A(7)", "OP", 1);
 
-	printf("\tSET_DN_REG8(M68K_REG_SR, OP);\n");
-	printf("\tSR &= M68K_FLAG_ALL;\n");
-	printf("\tREG_A(7) += 2;\n");
+	fprintf(out, "\tSET_DN_REG8(M68K_REG_SR, OP);\n");
+	fprintf(out, "\tSR &= M68K_FLAG_ALL;\n");
+	fprintf(out, "\tREG_A(7) += 2;\n");
 
 	READ_BUS("_pc", "REG_A(7)", "PC", 2);
 
-	printf("\tREG_A(7) += 4;\n");
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tREG_A(7) += 4;\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
@@ -1342,7 +1822,9 @@ int gen_quick(const char *mnemonic, int opcode, opcode_handler handler)
 	 && op_size == 0)
 		return invalid();
 
-	sprintf(func_name, "%s_%04X", mnemonic, opcode);
+	func_id = compact_function(func_name, mnemonic, opcode, ea_mode(opcode) < 7 ? 0x0007 : 0);
+	if (func_id >= 0)
+		return func_id;
 
 	func_id = begin_function(func_name);
 
@@ -1352,7 +1834,7 @@ int gen_quick(const char *mnemonic, int opcode, opcode_handler handler)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
 		sprintf(func_name, "%s_common_%02X", mnemonic, (op_size<<3)|((opcode>>9)&7));
 
@@ -1364,19 +1846,14 @@ int gen_quick(const char *mnemonic, int opcode, opcode_handler handler)
 		return -1;
 	if (ea_mode(opcode) < 2)
 	{
-		printf("\t\tSET_DN_REG%d(%d, result);\n\t}\n", 8<<(ea_mode(opcode)==1?2:op_size), opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG%d(%s, result);\n\t}\n", 8<<(ea_mode(opcode)==1?2:op_size), dn_reg_name(opcode));
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\t\tEV = result;\n\t}\n");
+		fprintf(out, "\t\tEV = result;\n\t}\n");
 
-		switch(op_size)
-		{
-			case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
-			case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
-			case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
-		}
+		print_done_write(op_size);
 	}
 	return func_id;
 }
@@ -1391,15 +1868,12 @@ int addq_handler(int opcode)
 		value = 8;
 
 	if (ea_mode(opcode) == 1)
-		printf("\t{\n\t\tuint32_t result = (uint32_t)(EV + %d);\n", value);
+		fprintf(out, "\t{\n\t\tuint32_t result = (uint32_t)(EV + %d);\n", value);
 	else
 	{
-		printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV + %d);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_C_FLAG((uint%d_t)result < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_X_FLAG((uint%d_t)result < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_V_FLAG%d(EV, %d, result);\n", 8<<op_size, value);
-		printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-		printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
+		fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV + %d);\n", 8<<op_size, 8<<op_size, value);
+		fprintf(out, "\t\tSET_X_FLAG((uint%d_t)result < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
+		print_flags("\t\tFLAGS_ADD(%d, %d, EV, result);\n", 8<<op_size, value);
 	}
 	return 0;
 }
@@ -1422,15 +1896,12 @@ int subq_handler(int opcode)
 		value = 8;
 
 	if (ea_mode(opcode) == 1)
-		printf("\t{\n\t\tuint32_t result = (uint32_t)(EV - %d);\n", value);
+		fprintf(out, "\t{\n\t\tuint32_t result = (uint32_t)(EV - %d);\n", value);
 	else
 	{
-		printf("\t{\n\t\tuint%d_t result = (uint%d_t)(EV - %d);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_C_FLAG((uint%d_t)EV < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_X_FLAG((uint%d_t)EV < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
-		printf("\t\tSET_V_FLAG%d(EV, -%d, result);\n", 8<<op_size, value);
-		printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-		printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
+		fprintf(out, "\t{\n\t\tuint%d_t result = (uint%d_t)(EV - %d);\n", 8<<op_size, 8<<op_size, value);
+		fprintf(out, "\t\tSET_X_FLAG((uint%d_t)EV < (uint%d_t)%d?1:0);\n", 8<<op_size, 8<<op_size, value);
+		print_flags("\t\tFLAGS_SUB(%d, %d, EV, result);\n", 8<<op_size, value);
 	}
 	return 0;
 }
@@ -1453,6 +1924,7 @@ char* cc_up(int code)
 		return 0;
 	for (i=0; cc_names[code][i]; ++i)
 		cc[i] = cc_names[code][i]-'a'+'A';
+	cc[i] = 0;
 	return cc;
 }
 
@@ -1492,21 +1964,21 @@ void scc(int opcode)
 		}
 	}
 
-	printf("\tif (CONDITION_%s)\n", cc_up(cc));
+	fprintf(out, "\tif (CONDITION_%s)\n", cc_up(cc));
 	if (ea_mode(opcode) < 2)
 	{
-		printf("\t\tSET_DN_REG8(%d, 0xFF);\n", opcode&0xF);
-		printf("\telse\n", opcode&0xF);
-		printf("\t\tSET_DN_REG8(%d, 0);\n", opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG8(%d, 0xFF);\n", opcode&0xF);
+		fprintf(out, "\telse\n", opcode&0xF);
+		fprintf(out, "\t\tSET_DN_REG8(%d, 0);\n", opcode&0xF);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\t\tEV = 0xFF;\n");
-		printf("\telse\n");
-		printf("\t\tEV = 0;\n");
+		fprintf(out, "\t\tEV = 0xFF;\n");
+		fprintf(out, "\telse\n");
+		fprintf(out, "\t\tEV = 0;\n");
 
-		print_bus_wait("done_wait_wb", "done_write_wb");
+		print_done_write(0);
 	}
 
 	add_opcode(func_id, opcode);
@@ -1530,11 +2002,11 @@ void dbcc(int opcode)
 
 	FETCH_BUS("", "OP", 1);
 
-	printf("\tif (!(CONDITION_%s))\n\t{\n", cc_up(cc));
-	printf("\t\tSET_DN_REG16(%d, REG_D(%d)-1);\n", opcode&7, opcode&7);
-	printf("\t\tif ((int16_t)(REG_D(%d)) != -1)\n", opcode&7);
-	printf("\t\t\tPC += (int16_t)OP - 2;\n\t}\n");
-	printf("\tFETCH_OPCODE;\n}\n\n");
+	fprintf(out, "\tif (!(CONDITION_%s))\n\t{\n", cc_up(cc));
+	fprintf(out, "\t\tSET_DN_REG16(%d, REG_D(%d)-1);\n", opcode&7, opcode&7);
+	fprintf(out, "\t\tif ((int16_t)(REG_D(%d)) != -1)\n", opcode&7);
+	fprintf(out, "\t\t\tPC += (int16_t)OP - 2;\n\t}\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 
 	add_opcode(func_id, opcode);
 }
@@ -1565,26 +2037,26 @@ void bcc(int opcode)
 	{
 		FETCH_BUS("", "OP", 1);
 		if (cc > 1)
-			printf("\tif (CONDITION_%c%c)\n", cc_names[cc][0]-'a'+'A', cc_names[cc][1]-'a'+'A');
+			fprintf(out, "\tif (CONDITION_%c%c)\n", cc_names[cc][0]-'a'+'A', cc_names[cc][1]-'a'+'A');
 		if (cc == 1) // bsr
 		{
-			printf("\tREG_A(7) -= 4;\n");
+			fprintf(out, "\tREG_A(7) -= 4;\n");
 			WRITE_BUS("_pc", "REG_A(7)", "PC", 2);
 		}
-		printf("\t\tPC += (int16_t)OP - 2;\n");
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tPC += (int16_t)OP - 2;\n");
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
 		if (cc > 1)
-			printf("\tif (CONDITION_%c%c)\n", cc_names[cc][0]-'a'+'A', cc_names[cc][1]-'a'+'A');
+			fprintf(out, "\tif (CONDITION_%c%c)\n", cc_names[cc][0]-'a'+'A', cc_names[cc][1]-'a'+'A');
 		if (cc == 1) // bsr
 		{
-			printf("\tREG_A(7) -= 4;\n");
+			fprintf(out, "\tREG_A(7) -= 4;\n");
 			WRITE_BUS("_pc", "REG_A(7)", "PC", 2);
 		}
-		printf("\t\tPC += (int8_t)%d;\n", opcode&0xFF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tPC += (int8_t)%d;\n", opcode&0xFF);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	add_opcode(func_id, opcode);
 }
@@ -1597,16 +2069,15 @@ void moveq(int opcode)
 	if ((opcode & 0xF100) != 0x7000)
 		return;
 
-	sprintf(func_name, "moveq_%04X", opcode);
+	func_id = compact_function(func_name, "moveq", opcode, 0x0E00);
+	if (func_id < 0)
+	{
+		func_id = begin_function(func_name);
 
-	func_id = begin_function(func_name);
-
-	printf("\tREG_D(%d) = (uint32_t)(int8_t)0x%X;\n", (opcode >> 9)&7, opcode&0xFF);
-	printf("\tSET_N_FLAG(%d);\n", (opcode&0x80)?1:0);
-	printf("\tSET_Z_FLAG(%d);\n", (opcode&0xFF)?0:1);
-	printf("\tSET_V_FLAG(0);\n");
-	printf("\tSET_C_FLAG(0);\n");
-	printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\tREG_D(%s) = (uint32_t)(int8_t)0x%X;\n", reg_name(((opcode >> 9)&7)|REG_X), opcode&0xFF);
+		print_flags("\tFLAGS_LOGIC(8, 0x%X);\n", opcode&0xFF);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
+	}
 
 	add_opcode(func_id, opcode);
 }
@@ -1630,7 +2101,10 @@ int gen_move(const char *mnemonic, int opcode)
 	 || ea_mode(opcode) < 0)
 		return invalid();
 
-	sprintf(func_name, "%s_%04X", mnemonic, opcode);
+	func_id = compact_function(func_name, mnemonic, opcode,
+		(ea_mode(opcode) < 7 ? 0x0007 : 0) | (ea_mode(op_dest) < 7 ? 0x0E00 : 0));
+	if (func_id >= 0)
+		return func_id;
 
 	func_id = begin_function(func_name);
 
@@ -1640,44 +2114,39 @@ int gen_move(const char *mnemonic, int opcode)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
-		sprintf(func_name, "%s_common_%02X", mnemonic, (op_size<<6)|op_dest);
+		if (reg_compact(op_dest|REG_X))
+			sprintf(func_name, "%s_common_r%02X", mnemonic, (op_size<<6)|(op_dest&0x38));
+		else
+			sprintf(func_name, "%s_common_%02X", mnemonic, (op_size<<6)|op_dest);
 		if (READ_BUS("", "EA", "EV", op_size) < 0)
 			return func_id;
 	}
 
-	printf("\t{\n\t\tuint%d_t result = EV;\n", 8<<op_size);
+	fprintf(out, "\t{\n\t\tuint%d_t result = EV;\n", 8<<op_size);
 	if (ea_mode(op_dest) != 1)
 	{
-		printf("\t\tSET_N_FLAG%d(result);\n", 8<<op_size);
-		printf("\t\tSET_Z_FLAG%d(result);\n", 8<<op_size);
-		printf("\t\tSET_V_FLAG(0);\n");
-		printf("\t\tSET_C_FLAG(0);\n");
+		print_flags("\t\tFLAGS_LOGIC(%d, result);\n", 8<<op_size);
 	}
 	if (ea_mode(op_dest) == 0)
 	{
-		printf("\t\tSET_DN_REG%d(%d, result);\n\t}\n", 8<<op_size, op_dest&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tSET_DN_REG%d(%s, result);\n\t}\n", 8<<op_size, dn_reg_name(op_dest|REG_X));
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else if (ea_mode(op_dest) == 1)
 	{
-		printf("\t\tREG_D(%d) = (uint32_t)(int%d_t)result;\n\t}\n", op_dest&0xF, 8<<op_size);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\t\tREG_D(%s) = (uint32_t)(int%d_t)result;\n\t}\n", dn_reg_name(op_dest|REG_X), 8<<op_size);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
 		sprintf(access_name, "%s_dest", func_name);
-		printf("\t\tEV = result;\n\t}\n");
-		if (get_ea(access_name, op_dest, op_size, 0) < 0)
+		fprintf(out, "\t\tEV = result;\n\t}\n");
+		if (get_ea(access_name, op_dest|REG_X, op_size, 0) < 0)
 			return -1;
 
-		switch(op_size)
-		{
-			case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
-			case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
-			case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
-		}
+		print_done_write(op_size);
 	}
 	return func_id;
 }
@@ -1714,7 +2183,7 @@ int gen_move_from_sr(const char *mnemonic, int opcode)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
 		sprintf(func_name, "%s_fsr_common", mnemonic);
 		if (READ_BUS("", "EA", "EV", op_size) < 0)
@@ -1723,19 +2192,14 @@ int gen_move_from_sr(const char *mnemonic, int opcode)
 
 	if (ea_mode(opcode)<2)
 	{
-		printf("\tSET_DN_REG%d(%d, SR);\n", 8<<op_size, opcode&0xF);
-		printf("\tFETCH_OPCODE;\n}\n\n");
+		fprintf(out, "\tSET_DN_REG%d(%d, SR);\n", 8<<op_size, opcode&0xF);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	}
 	else
 	{
-		printf("\tEV = SR;\n");
+		fprintf(out, "\tEV = SR;\n");
 
-		switch(op_size)
-		{
-			case 0: print_bus_wait("done_wait_wb", "done_write_wb"); break;
-			case 1: print_bus_wait("done_wait_ww", "done_write_ww"); break;
-			case 2: print_bus_wait("done_wait_wl", "done_write_wl"); break;
-		}
+		print_done_write(op_size);
 	}
 	return func_id;
 }
@@ -1767,7 +2231,7 @@ int gen_move_to_ccr(const char *mnemonic, int opcode)
 	func_id = begin_function(func_name);
 
 	if (sr)
-		printf("\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
+		fprintf(out, "\tif (!SUPERVISOR) PRIVILEGE_EXCEPTION;\n");
 
 	if (get_ea(func_name, opcode, op_size, 1) < 0)
 		return -1;
@@ -1775,7 +2239,7 @@ int gen_move_to_ccr(const char *mnemonic, int opcode)
 	if (ea_address(opcode))
 	{
 		if (op_size)
-			printf("\tif (EA&1) ADDRESS_EXCEPTION;\n");
+			fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
 
 		if (sr)
 			sprintf(func_name, "%s_sr_common", mnemonic);
@@ -1786,14 +2250,371 @@ int gen_move_to_ccr(const char *mnemonic, int opcode)
 	}
 
 	if (sr)
-		printf("\tSR = EV;\n");
+		fprintf(out, "\tSR = EV;\n");
+	else
+		fprintf(out, "\tSET_DN_REG8(M68K_REG_SR, EV);\n");
+	fprintf(out, "\tSR &= M68K_FLAG_ALL;\n");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
+	return func_id;
+}
+
+// word source, Dn destination, time depends on operands
+int gen_muldiv(const char *mnemonic, int opcode, opcode_handler handler)
+{
+	char func_name[MAX_NAME];
+	int func_id;
+
+	if (handler(check(opcode)) < 0)
+		return invalid();
+
+	func_id = compact_function(func_name, mnemonic, opcode, (ea_mode(opcode) < 7 ? 0x0007 : 0) | 0x0E00);
+	if (func_id >= 0)
+		return func_id;
+
+	func_id = begin_function(func_name);
+
+	if (get_ea(func_name, opcode, 1, 1) < 0)
+		return -1;
+
+	if (ea_address(opcode))
+	{
+		fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
+
+		sprintf(func_name, "%s_common_%s", mnemonic, reg_compact(REG_X) ? "r" : reg_name(((opcode>>9)&7)|REG_X));
+
+		if (READ_BUS("", "EA", "EV", 1) < 0)
+			return func_id;
+	}
+
+	if (handler(opcode) < 0)
+		return -1;
+
+	DELAY_VAR("_time", "time");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
+	return func_id;
+}
+
+int mul_handler(int opcode)
+{
+	const char *dn = reg_name(((opcode>>9)&7)|REG_X);
+	int sign = opcode & 0x100;
+
+	if (!ea_valid_na(opcode))
+		return -1;
+
+	if (is_checking(opcode))
+		return 0;
+
+	fprintf(out, "\tuint32_t time = m68k_mul%c_time(EV);\n", sign ? 's' : 'u');
+	if (sign)
+		fprintf(out, "\t{\n\t\tuint32_t result = (uint32_t)((int16_t)EV * (int16_t)REG_D(%s));\n", dn);
+	else
+		fprintf(out, "\t{\n\t\tuint32_t result = (uint16_t)EV * (uint32_t)(uint16_t)REG_D(%s);\n", dn);
+	print_flags("\t\tFLAGS_LOGIC(32, result);\n");
+	fprintf(out, "\t\tSET_DN_REG32(%s, result);\n\t}\n", dn);
+	return 0;
+}
+
+// quotient in low word, remainder in high word, or only V set on overflow
+int div_handler(int opcode)
+{
+	const char *dn = reg_name(((opcode>>9)&7)|REG_X);
+	int sign = opcode & 0x100;
+
+	if (!ea_valid_na(opcode))
+		return -1;
+
+	if (is_checking(opcode))
+		return 0;
+
+	fprintf(out, "\tif (!(uint16_t)EV)\n\t{\n");
+	print_flags("\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t\tZERO_DIVIDE;\n\t}\n");
+	fprintf(out, "\tuint32_t time = m68k_div%c_time(REG_D(%s), EV);\n", sign ? 's' : 'u', dn);
+	if (sign)
+	{
+		// 64-bit, so 0x80000000 / -1 is just an overflow
+		fprintf(out, "\t{\n\t\tint64_t quotient = (int64_t)(int32_t)REG_D(%s) / (int16_t)EV;\n", dn);
+		fprintf(out, "\t\tint64_t remainder = (int64_t)(int32_t)REG_D(%s) %% (int16_t)EV;\n", dn);
+		fprintf(out, "\t\tif (quotient != (int16_t)quotient)\n");
+	}
+	else
+	{
+		fprintf(out, "\t{\n\t\tuint32_t quotient = REG_D(%s) / (uint16_t)EV;\n", dn);
+		fprintf(out, "\t\tuint32_t remainder = REG_D(%s) %% (uint16_t)EV;\n", dn);
+		fprintf(out, "\t\tif (quotient > 0xFFFF)\n");
+	}
+	fprintf(out, "\t\t{\n");
+	print_flags("\t\t\tSET_N_FLAG(1);\n\t\t\tSET_Z_FLAG(0);\n\t\t\tSET_V_FLAG(1);\n\t\t\tSET_C_FLAG(0);\n");
+	fprintf(out, "\t\t}\n\t\telse\n\t\t{\n");
+	print_flags("\t\t\tFLAGS_LOGIC(16, quotient);\n");
+	fprintf(out, "\t\t\tSET_DN_REG32(%s, ((uint32_t)(uint16_t)remainder<<16) | (uint16_t)quotient);\n", dn);
+	fprintf(out, "\t\t}\n\t}\n");
+	return 0;
+}
+
+void mulu(int opcode)
+{
+	if ((opcode & 0xF1C0) != 0xC0C0)
+		return;
+
+	add_opcode(gen_muldiv("mulu", opcode, mul_handler), opcode);
+}
+
+void muls(int opcode)
+{
+	if ((opcode & 0xF1C0) != 0xC1C0)
+		return;
+
+	add_opcode(gen_muldiv("muls", opcode, mul_handler), opcode);
+}
+
+void divu(int opcode)
+{
+	if ((opcode & 0xF1C0) != 0x80C0)
+		return;
+
+	add_opcode(gen_muldiv("divu", opcode, div_handler), opcode);
+}
+
+void divs(int opcode)
+{
+	if ((opcode & 0xF1C0) != 0x81C0)
+		return;
+
+	add_opcode(gen_muldiv("divs", opcode, div_handler), opcode);
+}
+
+// Dy,Dx or -(Ay),-(Ax), one lookup into m68k_bcd_table
+int gen_bcd(const char *mnemonic, int opcode)
+{
+	char func_name[MAX_NAME];
+	char dec[32];
+	int func_id;
+	int sub = opcode < 0xC000;
+	const char *rx, *ry;
+
+	func_id = compact_function(func_name, mnemonic, opcode, 0x0E07);
+	if (func_id >= 0)
+		return func_id;
+
+	func_id = begin_function(func_name);
+	info.size = 0;
+
+	rx = reg_name(((opcode>>9)&7)|REG_X);
+	ry = reg_name(opcode&7);
+	if (!(opcode & 8))
+	{
+		fprintf(out, "\t{\n\t\tuint32_t bcd = m68k_bcd_table[%d][BCD_INDEX(REG_D(%s), REG_D(%s))];\n", sub, rx, ry);
+		print_flags("\t\tSET_BCD_FLAGS(bcd);\n");
+		fprintf(out, "\t\tSET_DN_REG8(%s, (uint8_t)bcd);\n\t}\n", rx);
+		DELAY("_bcd", 2);
+		fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
+		return func_id;
+	}
+
+	info.ea = info.ea_dest = 4;
+	DELAY("_pre", 2);
+
+	// sp is kept even
+	if (reg_compact(opcode))
+		sprintf(dec, "1 + (%s == 7)", ry);
+	else
+		sprintf(dec, "%d", (opcode&7) == 7 ? 2 : 1);
+	fprintf(out, "\tREG_A(%s) -= %s;\n", ry, dec);
+	fprintf(out, "\tEA = REG_A(%s);\n", ry);
+	if (READ_BUS("_src", "EA", "OP", 0) < 0)
+		return -1;
+
+	if (reg_compact(REG_X))
+		sprintf(dec, "1 + (%s == 7)", rx);
+	else
+		sprintf(dec, "%d", ((opcode>>9)&7) == 7 ? 2 : 1);
+	fprintf(out, "\tREG_A(%s) -= %s;\n", rx, dec);
+	fprintf(out, "\tEA = REG_A(%s);\n", rx);
+	if (READ_BUS("_dst", "EA", "EV", 0) < 0)
+		return -1;
+
+	fprintf(out, "\t{\n\t\tuint32_t bcd = m68k_bcd_table[%d][BCD_INDEX(EV, OP)];\n", sub);
+	print_flags("\t\tSET_BCD_FLAGS(bcd);\n");
+	fprintf(out, "\t\tEV = (uint8_t)bcd;\n\t}\n");
+	print_done_write(0);
+	return func_id;
+}
+
+void abcd(int opcode)
+{
+	if ((opcode & 0xF1F0) != 0xC100)
+		return;
+
+	add_opcode(gen_bcd("abcd", opcode), opcode);
+}
+
+void sbcd(int opcode)
+{
+	if ((opcode & 0xF1F0) != 0x8100)
+		return;
+
+	add_opcode(gen_bcd("sbcd", opcode), opcode);
+}
+
+// as, ls, rox, ro in order of type bits
+const char *shift_names[] = {"as", "ls", "rox", "ro"};
+
+// result of shifting value by count in one step, C, X and V by bit tricks,
+// count is at most 63, known count is not 0
+void print_shift(int type, int left, int op_size, const char *value, const char *count, int known)
+{
+	int bits = 8<<op_size;
+	unsigned long long mask = (1ULL<<bits) - 1;
+
+	fprintf(out, "\t{\n\t\tuint64_t v = (uint%d_t)%s;\n", bits, value);
+	switch (type*2 + left)
+	{
+		case 0: // asr
+			fprintf(out, "\t\tint64_t s = (int%d_t)v;\n", bits);
+			fprintf(out, "\t\tuint32_t result = (uint32_t)(s >> %s) & 0x%llX;\n", count, mask);
+			fprintf(out, "\t\tuint32_t c = (uint32_t)((s * 2) >> %s) & 1;\n", count);
+			break;
+		case 2: // lsr
+			fprintf(out, "\t\tuint32_t result = (uint32_t)(v >> %s);\n", count);
+			fprintf(out, "\t\tuint32_t c = (uint32_t)((v << 1) >> %s) & 1;\n", count);
+			break;
+		case 1: // asl
+		case 3: // lsl
+			fprintf(out, "\t\tuint64_t r = v << %s;\n", count);
+			fprintf(out, "\t\tuint32_t result = (uint32_t)r & 0x%llX;\n", mask);
+			fprintf(out, "\t\tuint32_t c = (uint32_t)(r >> %d) & 1;\n", bits);
+			break;
+		case 4: // roxr
+		case 5: // roxl
+			// X is bit above value, so it's rotation of bits+1 bits
+			fprintf(out, "\t\tuint64_t w = v | ((uint64_t)GET_X_FLAG() << %d);\n", bits);
+			fprintf(out, "\t\tuint32_t k = %s %% %d;\n", count, bits + 1);
+			if (left)
+				fprintf(out, "\t\tuint64_t r = ((w << k) | (w >> (%d - k))) & 0x%llX;\n", bits + 1, (mask<<1)|1);
+			else
+				fprintf(out, "\t\tuint64_t r = ((w >> k) | (w << (%d - k))) & 0x%llX;\n", bits + 1, (mask<<1)|1);
+			fprintf(out, "\t\tuint32_t result = (uint32_t)r & 0x%llX;\n", mask);
+			fprintf(out, "\t\tuint32_t c = (uint32_t)(r >> %d);\n", bits);
+			break;
+		case 6: // ror
+		case 7: // rol
+			fprintf(out, "\t\tuint32_t k = %s & %d;\n", count, bits - 1);
+			if (left)
+				fprintf(out, "\t\tuint32_t result = (uint32_t)((v << k) | (v >> (%d - k))) & 0x%llX;\n", bits, mask);
+			else
+				fprintf(out, "\t\tuint32_t result = (uint32_t)((v >> k) | (v << (%d - k))) & 0x%llX;\n", bits, mask);
+			// carry of rotation without X is only seen through flags
+			if (flags_dead)
+				break;
+			if (known)
+				fprintf(out, "\t\tuint32_t c = (result >> %d) & 1;\n", left ? 0 : bits - 1);
+			else
+				fprintf(out, "\t\tuint32_t c = %s ? (result >> %d) & 1 : 0;\n", count, left ? 0 : bits - 1);
+			break;
+	}
+
+	print_flags("\t\tFLAGS_LOGIC(%d, result);\n", bits);
+	print_flags("\t\tSET_C_FLAG(c);\n");
+	// MSB changed while shifting if shifting back differs
+	if (type == 0 && left)
+		print_flags("\t\tSET_V_FLAG((int64_t)(int%d_t)result >> %s != (int64_t)(int%d_t)v ? 1 : 0);\n", bits, count, bits);
+	if (type == 2 || (type < 2 && known))
+		fprintf(out, "\t\tSET_X_FLAG(c);\n");
+	else if (type < 2)
+		fprintf(out, "\t\tif (%s) SET_X_FLAG(c);\n", count);
+}
+
+// register form takes 6+2n or 8+2n cycles for long, memory one shifts word by 1
+int gen_shift(int opcode)
+{
+	char func_name[MAX_NAME];
+	char mnemonic[8];
+	char count[32];
+	char value[32];
+	int func_id, op_size, type, left, known;
+	const char *dy;
+
+	op_size = (opcode >> 6) & 3;
+	left = (opcode >> 8) & 1;
+	if (op_size == 3)
+	{
+		type = (opcode >> 9) & 3;
+		if ((opcode & 0x0800) || !ea_alterable(opcode) || ea_mode(opcode) < 2)
+			return invalid();
+	}
+	else
+		type = (opcode >> 3) & 3;
+	sprintf(mnemonic, "%s%c", shift_names[type], left ? 'l' : 'r');
+
+	if (op_size == 3)
+	{
+		func_id = compact_function(func_name, mnemonic, opcode, ea_mode(opcode) < 7 ? 0x0007 : 0);
+		if (func_id >= 0)
+			return func_id;
+
+		func_id = begin_function(func_name);
+
+		if (get_ea(func_name, opcode, 1, 1) < 0)
+			return -1;
+
+		fprintf(out, "\tif (EA&1) ADDRESS_EXCEPTION;\n");
+
+		sprintf(func_name, "%s_mem_common", mnemonic);
+
+		if (READ_BUS("", "EA", "EV", 1) < 0)
+			return func_id;
+
+		print_shift(type, left, 1, "EV", "1", 1);
+		fprintf(out, "\t\tEV = result;\n\t}\n");
+		print_done_write(1);
+		return func_id;
+	}
+
+	func_id = compact_function(func_name, mnemonic, opcode, 0x0E07);
+	if (func_id >= 0)
+		return func_id;
+
+	func_id = begin_function(func_name);
+	info.size = op_size;
+
+	dy = reg_name(opcode & 7);
+	known = !(opcode & 0x20) && !reg_compact(REG_X);
+	if (known)
+		sprintf(count, "%d", (((opcode >> 9) - 1) & 7) + 1);
+	else if (opcode & 0x20)
+		sprintf(count, "(REG_D(%s) & 63)", reg_name(((opcode >> 9) & 7)|REG_X));
+	else
+		sprintf(count, "(((%s - 1) & 7) + 1)", reg_name(((opcode >> 9) & 7)|REG_X));
+
+	if (!known)
+	{
+		fprintf(out, "\tuint32_t count = %s;\n", count);
+		fprintf(out, "\tuint32_t time = %d + 2*count;\n", op_size == 2 ? 4 : 2);
+		strcpy(count, "count");
+	}
+
+	sprintf(value, "REG_D(%s)", dy);
+	print_shift(type, left, op_size, value, count, known);
+	fprintf(out, "\t\tSET_DN_REG%d(%s, result);\n\t}\n", 8<<op_size, dy);
+
+	if (known)
+		DELAY("_shift", (op_size == 2 ? 4 : 2) + 2*atoi(count));
 	else
-		printf("\tSET_DN_REG8(M68K_REG_SR, EV);\n");
-	printf("\tSR &= M68K_FLAG_ALL;\n");
-	printf("\tFETCH_OPCODE;\n}\n\n");
+		DELAY_VAR("_shift", "time");
+	fprintf(out, "\tFETCH_OPCODE;\n}\n\n");
 	return func_id;
 }
 
+void shift(int opcode)
+{
+	if ((opcode & 0xF000) != 0xE000)
+		return;
+
+	add_opcode(gen_shift(opcode), opcode);
+}
+
 void move_tcr(int opcode)
 {
 	if ((opcode & 0xFDC0) != 0x44C0)
@@ -1801,83 +2622,1423 @@ void move_tcr(int opcode)
 	add_opcode(gen_move_to_ccr("move", opcode), opcode);
 }
 
-int main(void)
+void gen_opcode(int opcode)
+{
+	ori(opcode);
+	andi(opcode);
+	subi(opcode);
+	addi(opcode);
+	eori(opcode);
+	cmpi(opcode);
+	btst(opcode);
+	bchg(opcode);
+	bclr(opcode);
+	bset(opcode);
+	negx(opcode);
+	clr(opcode);
+	neg(opcode);
+	not(opcode);
+	swap(opcode);
+	ext(opcode);
+	movem(opcode);
+	nbcd(opcode);
+	tst(opcode);
+	nop(opcode);
+	stop(opcode);
+	rte(opcode);
+	rts(opcode);
+	rtr(opcode);
+	addq(opcode);
+	subq(opcode);
+	scc(opcode);
+	dbcc(opcode);
+	bcc(opcode);
+	moveq(opcode);
+	move(opcode);
+	move_fsr(opcode);
+	move_tcr(opcode);
+	mulu(opcode);
+	muls(opcode);
+	divu(opcode);
+	divs(opcode);
+	shift(opcode);
+	abcd(opcode);
+	sbcd(opcode);
+}
+
+// register forms setting whole NZVC can't fault, so if next such
+// instruction follows, flags of first one are never seen
+int flags_dead_form(int opcode)
+{
+	int size = (opcode>>6)&3;
+	int src = opcode&0x3F;
+
+	switch (opcode>>12)
+	{
+		case 0x0: // ori, andi, subi, addi, eori, cmpi
+			return (opcode & 0x138) == 0 && size != 3
+			    && ((opcode>>9)&7) != 4 && ((opcode>>9)&7) != 7;
+		case 0x4: // clr, neg, not, tst, swap, ext
+			if ((opcode & 0xFFF8) == 0x4840
+			 || (opcode & 0xFFB8) == 0x4880)
+				return 1;
+			return (opcode & 0x38) == 0 && size != 3
+			    && ((opcode>>8) == 0x42 || (opcode>>8) == 0x44
+			     || (opcode>>8) == 0x46 || (opcode>>8) == 0x4A);
+		case 0x5: // addq, subq
+			return (opcode & 0x38) == 0 && size != 3;
+		case 0x7: // moveq
+			return 1;
+		case 0x1: case 0x2: case 0x3: // move from register or immediate
+			return (opcode & 0x1C0) == 0 && ((src>>3) <= 1 || src == 0x3C);
+		case 0xE: // shifts and rotates of Dn
+			return size != 3;
+	}
+	return 0;
+}
+
+// same as M68K_FAST_FLAGS_* of m68k_opcode.h
+#define FLAGS_WRITE 1 // whole NZVC is overwritten without fault
+#define FLAGS_KEEP  2 // NZVC are not touched, no fault or jump
+
+int opcode_flags(int opcode)
 {
-	int i;
-	FILE *f;
+	if (valid_nf[opcode] >= 0)
+		return FLAGS_WRITE;
+	if (opcode == 0x4E71 // nop
+	 || ((opcode & 0xF038) == 0x5008 && valid[opcode] != invalid())) // addq, subq to An
+		return FLAGS_KEEP;
+	return 0;
+}
 
-	hash_init();
+// same as M68K_FLAG_*_MASK of m68k.h
+#define CCR_C 0x01
+#define CCR_V 0x02
+#define CCR_Z 0x04
+#define CCR_N 0x08
+#define CCR_X 0x10
+#define CCR_NZVC (CCR_N|CCR_Z|CCR_V|CCR_C)
+#define CCR_ALL (CCR_X|CCR_NZVC)
+
+// flags tested by condition, same order as cc_names
+int cc_flags[] = {0, 0, CCR_C|CCR_Z, CCR_C|CCR_Z, CCR_C, CCR_C, CCR_Z, CCR_Z,
+	CCR_V, CCR_V, CCR_N, CCR_N, CCR_N|CCR_V, CCR_N|CCR_V, CCR_N|CCR_Z|CCR_V, CCR_N|CCR_Z|CCR_V};
+
+int ccr_read(int opcode)
+{
+	if (valid[opcode] == invalid())
+		return 0;
+	if ((opcode & 0xFFC0) == 0x40C0) // move from sr
+		return CCR_ALL;
+	if ((opcode & 0xFF00) == 0x4000 || (opcode & 0xFFC0) == 0x4800 // negx, nbcd
+	 || (opcode & 0xB1F0) == 0x8100) // abcd, sbcd
+		return CCR_X|CCR_Z;
+	if ((opcode & 0xF0C0) == 0x50C0 || (opcode & 0xF000) == 0x6000) // scc, dbcc, bcc
+		return cc_flags[(opcode>>8)&0xF];
+	if ((opcode & 0xF000) == 0xE000 && ((opcode & 0xC0) == 0xC0 ? (opcode & 0x600) == 0x400 : (opcode & 0x18) == 0x10)) // roxl, roxr
+		return CCR_X;
+	return 0;
+}
+
+int ccr_written(int opcode)
+{
+	if (valid[opcode] == invalid())
+		return 0;
+	switch (opcode>>12)
+	{
+		case 0x0:
+			if ((opcode & 0x100) || (opcode & 0xFF00) == 0x0800) // bit ones
+				return CCR_Z;
+			if ((opcode & 0xFF00) == 0x0400 || (opcode & 0xFF00) == 0x0600) // subi, addi
+				return CCR_ALL;
+			return CCR_NZVC;
+		case 0x4:
+			if ((opcode & 0xFFC0) == 0x40C0 || opcode == 0x4E71 || opcode == 0x4E75) // move from sr, nop, rts
+				return 0;
+			if ((opcode & 0xFFC0) == 0x44C0 || (opcode & 0xFFC0) == 0x46C0 // move to ccr, sr
+			 || opcode == 0x4E72 || opcode == 0x4E73 || opcode == 0x4E77) // stop, rte, rtr
+				return CCR_ALL;
+			if ((opcode & 0xFF00) == 0x4000 || (opcode & 0xFF00) == 0x4400 // negx, neg
+			 || (opcode & 0xFFC0) == 0x4800) // nbcd
+				return CCR_ALL;
+			if ((opcode & 0xFB80) == 0x4880 && (opcode & 0x38)) // movem
+				return 0;
+			return CCR_NZVC;
+		case 0x5:
+			if ((opcode & 0xC0) == 0xC0 || (opcode & 0x38) == 0x08) // scc, dbcc, to An
+				return 0;
+			return CCR_ALL;
+		case 0x8: case 0xC:
+			if ((opcode & 0x1F0) == 0x100) // abcd, sbcd
+				return CCR_ALL;
+			return CCR_NZVC; // divu, divs, mulu, muls
+		case 0x7: // moveq
+			return CCR_NZVC;
+		case 0x1: case 0x2: case 0x3:
+			return (opcode & 0x1C0) == 0x40 ? 0 : CCR_NZVC; // movea
+		case 0xE:
+			if (((opcode & 0xC0) == 0xC0 ? (opcode & 0x600) == 0x600 : (opcode & 0x18) == 0x18)) // rol, ror
+				return CCR_NZVC;
+			return CCR_ALL;
+	}
+	return 0;
+}
 
-	printf("#include \"m68k_opcode.h\"\n");
-	printf("#include \"m68k_optable.h\"\n\n");
+// functions differing only in names of states they pass control to are
+// merged, generated code waits in temporary file until then
+FILE *body_file = 0;
+int fixed_count = 0; // functions declared before opcodes keep their names
+int exception_count = 0; // first states listed in m68k_states.h
 
-	reset_exception();
-	address_exception();
-	interrupt();
+// heat of function is count of most frequent opcode passing control to it,
+// functions are written hottest first and exception ones last
+unsigned long long *func_heat = 0;
+unsigned long long *merge_heat = 0;
+int *merge_chunk_func = 0;
 
-	declare_function("invalid");
-	declare_function("done_wait_wb");
-	declare_function("done_wait_ww");
-	declare_function("done_wait_wl");
-	declare_function("done_wait_wl2");
-	declare_function("done_write_wb");
-	declare_function("done_write_ww");
-	declare_function("done_write_wl");
-	declare_function("done_write_wl2");
+char *class_key[HASH_SIZE];
+int class_len[HASH_SIZE];
+int class_id[HASH_SIZE];
+int class_count = 0;
+
+int class_of(const char *key, int len)
+{
+	int i, hash;
 
-	declare_function("opcode_wait");
-	declare_function("opcode_read");
+	hash = 0;
+	for (i=0; i<len; ++i)
+	{
+		hash *= 21; // random constant
+		hash += (unsigned char)key[i];
+	}
 
+	for (i = hash&HASH_MASK; class_key[i]; i = (i+1)&HASH_MASK)
+		if (class_len[i] == len && !memcmp(class_key[i], key, len))
+			return class_id[i];
 
-	for (i=0; i<0x10000; ++i)
+	if (class_count >= HASH_SIZE/2)
 	{
-		valid[i] = invalid();
-		ori(i);
-		andi(i);
-		subi(i);
-		addi(i);
-		eori(i);
-		cmpi(i);
-		btst(i);
-		bchg(i);
-		bclr(i);
-		bset(i);
-		negx(i);
-		clr(i);
-		neg(i);
-		not(i);
-		swap(i);
-		ext(i);
-		tst(i);
-		nop(i);
-		stop(i);
-		rte(i);
-		rts(i);
-		rtr(i);
-		addq(i);
-		subq(i);
-		scc(i);
-		dbcc(i);
-		bcc(i);
-		moveq(i);
-		move(i);
-		move_fsr(i);
-		move_tcr(i);
+		fprintf(stderr, "Error! Hash is full! Increase HASH_SIZE\n");
+		exit(0);
 	}
+	class_key[i] = (char*)malloc(len);
+	memcpy(class_key[i], key, len);
+	class_len[i] = len;
+	class_id[i] = class_count;
+	return class_count++;
+}
 
-	f = fopen("m68k_optable.h","wb");
-	for (i=0; i<func_count; ++i)
-		fprintf(f, "M68K_FUNCTION(%s);\n", func_names[i]);
-	fprintf(f, "\nextern m68k_function m68k_opcode_table[0x10000];\n");
-	fclose(f);
+void class_reset(void)
+{
+	int i;
+	for (i=0; i<HASH_SIZE; ++i)
+	{
+		free(class_key[i]);
+		class_key[i] = 0;
+	}
+	class_count = 0;
+}
 
-	f = fopen("m68k_optable.c","wb");
-	fprintf(f, "#include \"m68k_opcode.h\"\n\nm68k_function m68k_opcode_table[0x10000] = {\n");
-	for (i=0; i<0x10000; ++i)
+// exception states, rarely entered whichever opcodes name them
+int cold_state(const char *name)
+{
+	return !strncmp(name, "reset_exception", 15)
+	 || !strncmp(name, "address_exception", 17)
+	 || !strncmp(name, "interrupt", 9)
+	 || !strncmp(name, "trap_exception", 14)
+	 || !strcmp(name, "invalid");
+}
+
+int merge_order(const void *a, const void *b)
+{
+	int x = *(const int*)a, y = *(const int*)b;
+	unsigned long long hx = merge_heat[merge_chunk_func[x]];
+	unsigned long long hy = merge_heat[merge_chunk_func[y]];
+	int cx = cold_state(func_names[merge_chunk_func[x]]);
+	int cy = cold_state(func_names[merge_chunk_func[y]]);
+	if (cx != cy)
+		return cx - cy;
+	if (hx != hy)
+		return hx < hy ? 1 : -1;
+	return x - y;
+}
+
+void merge_begin(void)
+{
+	body_file = tmpfile();
+	if (!body_file)
 	{
-		int id = valid[i];
-		fprintf(f, "%s,\n", func_names[id]);
+		fprintf(stderr, "Error: can't create temporary file\n");
+		exit(0);
 	}
-	fprintf(f, "};\n");
+	out = body_file;
+}
+
+#define MAX_REFS 64 // functions named by one function
+
+// text of function with names of functions replaced by '@', they go to refs
+char* merge_template(const char *start, const char *end, int *refs, int *ref_count)
+{
+	char name[MAX_NAME];
+	char *text, *t;
+	const char *p, *q;
+	int id, len;
+
+	t = text = (char*)malloc(end - start + 1);
+	*ref_count = 0;
+	for (p = start; p < end; p = q)
+	{
+		q = p + 1;
+		if (*p != '_' && (*p < 'a' || *p > 'z') && (*p < 'A' || *p > 'Z'))
+		{
+			// rest of number
+			if (*p >= '0' && *p <= '9')
+				while (q < end && ((*q >= '0' && *q <= '9')
+				 || (*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z')))
+					++q;
+			memcpy(t, p, q - p);
+			t += q - p;
+			continue;
+		}
+
+		while (q < end && (*q == '_' || (*q >= 'a' && *q <= 'z')
+		 || (*q >= 'A' && *q <= 'Z') || (*q >= '0' && *q <= '9')))
+			++q;
+
+		len = q - p;
+		id = -1;
+		if (len < MAX_NAME)
+		{
+			memcpy(name, p, len);
+			name[len] = 0;
+			id = func_by_name(name);
+			// header of fast handler
+			if (id < 0 && fast_mode && !strncmp(name, "fast_", 5))
+			{
+				id = func_by_name(name + 5);
+				if (id >= 0)
+				{
+					memcpy(t, "fast_", 5);
+					t += 5;
+				}
+			}
+		}
+
+		if (id < 0)
+		{
+			memcpy(t, p, len);
+			t += len;
+		}
+		else if (*ref_count >= MAX_REFS)
+		{
+			fprintf(stderr, "Error: too many functions named by %s\n", func_names[refs[0]]);
+			exit(0);
+		}
+		else
+		{
+			*t++ = '@';
+			refs[(*ref_count)++] = id;
+		}
+	}
+	*t = 0;
+	return text;
+}
+
+// partition refinement, functions are equal while their templates are equal
+// and functions they name are equal, first one of each class is kept
+void merge_functions(void)
+{
+	char header[MAX_NAME];
+	char *text, *p, **chunk, **templ;
+	int **refs, *ref_count, *func_chunk, *cls, *rep, *new_id, *order;
+	int key[MAX_REFS + 1];
+	int i, j, id, count, chunk_count, changed;
+	long size;
+
+	fseek(body_file, 0, SEEK_END);
+	size = ftell(body_file);
+	// leading new line, so first header is found as others
+	text = (char*)malloc(size + 2);
+	text[0] = '\n';
+	fseek(body_file, 0, SEEK_SET);
+	if ((long)fread(text + 1, 1, size, body_file) != size)
+	{
+		fprintf(stderr, "Error: can't read temporary file\n");
+		exit(0);
+	}
+	text[size + 1] = 0;
+	fclose(body_file);
+	out = stdout;
+
+	// function lasts from its header until next one
+	sprintf(header, "\n%s(", fast_mode ? "M68K_FAST_FUNCTION" : state_macro());
+	chunk_count = 0;
+	for (p = strstr(text, header); p; p = strstr(p + 1, header))
+		++chunk_count;
+	chunk = (char**)malloc((chunk_count + 1) * sizeof(char*));
+	templ = (char**)malloc(chunk_count * sizeof(char*));
+	refs = (int**)malloc(chunk_count * sizeof(int*));
+	ref_count = (int*)malloc(chunk_count * sizeof(int));
+	chunk_count = 0;
+	for (p = strstr(text, header); p; p = strstr(p + 1, header))
+		chunk[chunk_count++] = p + 1;
+	chunk[chunk_count] = text + size + 1;
+
+	func_chunk = (int*)malloc(func_count * sizeof(int));
+	for (id=0; id<func_count; ++id)
+		func_chunk[id] = -1;
+	for (i=0; i<chunk_count; ++i)
+	{
+		refs[i] = (int*)malloc(MAX_REFS * sizeof(int));
+		templ[i] = merge_template(chunk[i], chunk[i+1], refs[i], &ref_count[i]);
+		func_chunk[refs[i][0]] = i; // name in header
+	}
+
+	cls = (int*)malloc(func_count * sizeof(int));
+	for (id=0; id<func_count; ++id)
+	{
+		i = func_chunk[id];
+		if (id < fixed_count || i < 0)
+			cls[id] = class_of((char*)&id, sizeof(id)); // templates are longer
+		else
+			cls[id] = class_of(templ[i], strlen(templ[i]));
+	}
+
+	do
+	{
+		count = class_count;
+		class_reset();
+		for (id=0; id<func_count; ++id)
+		{
+			i = func_chunk[id];
+			key[0] = cls[id];
+			if (id < fixed_count || i < 0)
+			{
+				cls[id] = class_of((char*)key, sizeof(int));
+				continue;
+			}
+			for (j=0; j<ref_count[i]; ++j)
+				key[j+1] = cls[refs[i][j]];
+			cls[id] = class_of((char*)key, (ref_count[i] + 1) * sizeof(int));
+		}
+	}
+	while (class_count != count);
+	class_reset();
+
+	rep = (int*)malloc(count * sizeof(int));
+	for (i=0; i<count; ++i)
+		rep[i] = -1;
+	for (id=0; id<func_count; ++id)
+		if (rep[cls[id]] < 0)
+			rep[cls[id]] = id;
+
+	merge_heat = (unsigned long long*)calloc(func_count, sizeof(unsigned long long));
+	for (i=0; i<0x10000; ++i)
+	{
+		if (merge_heat[valid[i]] < profile_count[i])
+			merge_heat[valid[i]] = profile_count[i];
+		if (fast_mode && valid_nf[i] >= 0 && merge_heat[valid_nf[i]] < profile_count[i])
+			merge_heat[valid_nf[i]] = profile_count[i];
+	}
+	do
+	{
+		changed = 0;
+		for (i=0; i<chunk_count; ++i)
+		{
+			id = refs[i][0];
+			if (cold_state(func_names[id]))
+				continue;
+			for (j=1; j<ref_count[i]; ++j)
+				if (merge_heat[refs[i][j]] < merge_heat[id])
+				{
+					merge_heat[refs[i][j]] = merge_heat[id];
+					changed = 1;
+				}
+		}
+	}
+	while (changed);
+	// class is as hot as its hottest function
+	for (id=0; id<func_count; ++id)
+	{
+		if (cold_state(func_names[id]))
+			merge_heat[id] = 0;
+		if (rep[cls[id]] != id && merge_heat[rep[cls[id]]] < merge_heat[id])
+			merge_heat[rep[cls[id]]] = merge_heat[id];
+	}
+
+	order = (int*)malloc(chunk_count * sizeof(int));
+	merge_chunk_func = (int*)malloc(chunk_count * sizeof(int));
+	count = 0;
+	for (i=0; i<chunk_count; ++i)
+	{
+		merge_chunk_func[i] = refs[i][0];
+		if (rep[cls[refs[i][0]]] == refs[i][0])
+			order[count++] = i;
+	}
+	qsort(order, count, sizeof(int), merge_order);
+
+	fwrite(text + 1, 1, chunk[0] - text - 1, out);
+	for (j=0; j<count; ++j)
+	{
+		i = order[j];
+		id = 0;
+		for (p = templ[i]; *p; ++p)
+		{
+			if (*p == '@')
+				fputs(func_names[rep[cls[refs[i][id++]]]], out);
+			else
+				fputc(*p, out);
+		}
+	}
+
+	// kept functions are renumbered in same order
+	new_id = (int*)malloc(func_count * sizeof(int));
+	func_heat = (unsigned long long*)malloc(func_count * sizeof(unsigned long long));
+	count = 0;
+	for (id=0; id<func_count; ++id)
+	{
+		if (rep[cls[id]] != id)
+		{
+			free(func_names[id]);
+			continue;
+		}
+		func_names[count] = func_names[id];
+		func_words[count] = func_words[id];
+		func_flags[count] = func_flags[id];
+		func_info[count] = func_info[id];
+		func_heat[count] = merge_heat[id];
+		new_id[id] = count++;
+	}
+	for (id=0; id<func_count; ++id)
+		new_id[id] = new_id[rep[cls[id]]];
+
+	for (i=0; i<0x10000; ++i)
+	{
+		valid[i] = new_id[valid[i]];
+		if (valid_nf[i] >= 0)
+			valid_nf[i] = new_id[valid_nf[i]];
+	}
+
+	func_count = count;
+	hash_init();
+	for (id=0; id<func_count; ++id)
+		hash_insert(func_names[id], id);
+
+	for (i=0; i<chunk_count; ++i)
+	{
+		free(templ[i]);
+		free(refs[i]);
+	}
+	free(chunk);
+	free(templ);
+	free(refs);
+	free(ref_count);
+	free(func_chunk);
+	free(cls);
+	free(rep);
+	free(new_id);
+	free(order);
+	free(merge_chunk_func);
+	free(merge_heat);
+	free(text);
+}
+
+// ahead-of-time translation of ROM mapped at address 0
+#define REC_MAX_BLOCK 64 // instructions per block
+
+unsigned char *rom = 0;
+long rom_size = 0;
+char *rec_started = 0; // per ROM word, block is known to start here
+long *rec_work = 0;
+int rec_work_count = 0;
+
+int rom_16(long address)
+{
+	return (rom[address]<<8)|rom[address+1];
+}
+
+long rom_32(long address)
+{
+	return ((long)rom_16(address)<<16)|rom_16(address+2);
+}
+
+void rec_push(long address)
+{
+	address &= 0xFFFFFF;
+	if ((address & 1)
+	 || address + 2 > rom_size
+	 || rec_started[address>>1])
+		return;
+
+	rec_started[address>>1] = 1;
+	rec_work[rec_work_count++] = address;
+}
+
+// adds known successors of control flow instruction, returns 1 if it ends block
+int rec_flow(long pc, int opcode)
+{
+	long next = pc + opcode_length[opcode]*2;
+
+	if ((opcode & 0xF000) == 0x6000) // bcc, bra, bsr
+	{
+		if (opcode & 0xFF)
+			rec_push(pc + 2 + (signed char)opcode);
+		else
+			rec_push(pc + 2 + (short)rom_16(pc + 2));
+		if (((opcode>>8)&0xF) != 0)
+			rec_push(next);
+		return 1;
+	}
+
+	if ((opcode & 0xF0F8) == 0x50C8) // dbcc
+	{
+		rec_push(pc + 2 + (short)rom_16(pc + 2));
+		rec_push(next);
+		return 1;
+	}
+
+	switch (opcode)
+	{
+		case 0x4E72: // stop, continues after interrupt
+			rec_push(next);
+			return 1;
+
+		case 0x4E73: // rte
+		case 0x4E75: // rts
+		case 0x4E77: // rtr
+			return 1;
+	}
+	return 0;
+}
+
+int rec_valid(long pc)
+{
+	int opcode;
+
+	if (pc + 2 > rom_size)
+		return 0;
+
+	opcode = rom_16(pc);
+	return valid[opcode] != invalid()
+	    && pc + opcode_length[opcode]*2 <= rom_size;
+}
+
+// writes one function per block found from vectors of ROM
+void rec_rom(const char *name)
+{
+	FILE *f;
+	long *blocks;
+	long pc, start;
+	long insn[REC_MAX_BLOCK];
+	int dead[REC_MAX_BLOCK];
+	int i, k, n, opcode, end, count, live, id;
+
+	f = fopen(name, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "Error: can't open ROM %s\n", name);
+		exit(0);
+	}
+	fseek(f, 0, SEEK_END);
+	rom_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (rom_size < 0)
+	{
+		fprintf(stderr, "Error: can't read ROM %s\n", name);
+		exit(0);
+	}
+	rom = (unsigned char*)malloc(rom_size + 1);
+	rec_started = (char*)calloc(rom_size/2 + 1, 1);
+	rec_work = (long*)malloc((rom_size/2 + 1) * sizeof(long));
+	blocks = (long*)malloc((rom_size/2 + 1) * sizeof(long));
+	if (!rom || !rec_started || !rec_work || !blocks
+	 || fread(rom, 1, rom_size, f) != (size_t)rom_size)
+	{
+		fprintf(stderr, "Error: can't read ROM %s\n", name);
+		exit(0);
+	}
+	fclose(f);
+
+	// reset pc and all exception vectors
+	for (i=1; i<64 && i*4+4 <= rom_size; ++i)
+		rec_push(rom_32(i*4));
+
+	f = fopen("m68k_rec_blocks.c","wb");
+	fprintf(f, "#define M68K_FAST\n#include \"m68k_opcode.h\"\n#include \"m68k_fast_optable.h\"\n\n");
+
+	count = 0;
+	while (rec_work_count)
+	{
+		start = pc = rec_work[--rec_work_count];
+		if (!rec_valid(pc))
+			continue;
+
+		blocks[count++] = start;
+		fprintf(f, "static uint32_t rec_%06lX(m68k_context *m68k)\n{\n", start);
+		fprintf(f, "\tuint32_t cycles = 0, time;\n\n");
+
+		end = 0;
+		for (n=0; n<REC_MAX_BLOCK && !end && rec_valid(pc); ++n)
+		{
+			insn[n] = pc;
+			end = rec_flow(pc, rom_16(pc));
+			pc += opcode_length[rom_16(pc)]*2;
+		}
+		if (!end)
+			rec_push(pc);
+
+		// flags overwritten before use are not computed, flags are live
+		// at block end since next block is unknown
+		live = 1;
+		for (k=n-1; k>=0; --k)
+		{
+			dead[k] = 0;
+			switch (opcode_flags(rom_16(insn[k])))
+			{
+				case FLAGS_WRITE: dead[k] = !live; live = 0; break;
+				case FLAGS_KEEP: break;
+				default: live = 1; break;
+			}
+		}
+
+		for (k=0; k<n; ++k)
+		{
+			pc = insn[k];
+			opcode = rom_16(pc);
+			id = dead[k] ? valid_nf[opcode] : valid[opcode];
+			fprintf(f, "\t// %06lX\n", pc);
+			if (opcode_length[opcode] > 1)
+			{
+				fprintf(f, "\tstatic const uint16_t ext_%06lX[] = {", pc);
+				for (i=1; i<opcode_length[opcode]; ++i)
+					fprintf(f, "%s0x%04X", i > 1 ? ", " : "", rom_16(pc + i*2));
+				fprintf(f, "};\n");
+				fprintf(f, "\tm68k->ext = ext_%06lX;\n", pc);
+			}
+			fprintf(f, "\tm68k->opcode = 0x%04X;\n", opcode);
+			fprintf(f, "\tPC += 2;\n");
+			fprintf(f, "\tif (!(time = fast_%s(m68k)))\n\t\tgoto stop;\n", func_names[id]);
+			fprintf(f, "\tcycles += time;\n\n");
+		}
+
+		fprintf(f, "\treturn cycles;\n\n");
+		fprintf(f, "stop: // next_func is set by handler\n");
+		fprintf(f, "\tm68k->timeout += cycles;\n\treturn 0;\n}\n\n");
+	}
+
+	fprintf(f, "const m68k_rec_block m68k_rec_blocks[] = {\n");
+	for (i=0; i<count; ++i)
+		fprintf(f, "\t{0x%06lX, rec_%06lX},\n", blocks[i], blocks[i]);
+	fprintf(f, "};\n\nconst uint32_t m68k_rec_block_count = %d;\n", count);
+	fclose(f);
+}
+
+// superinstructions: fast handler of first opcode of pair also runs second
+#define FUSE_MAX_RULES 64
+
+int fuse_first_value[FUSE_MAX_RULES], fuse_first_mask[FUSE_MAX_RULES];
+int fuse_second_value[FUSE_MAX_RULES], fuse_second_mask[FUSE_MAX_RULES];
+int fuse_count = 0;
+int fused[0x10000]; // opcode has fused handler
+
+// each line is "first/mask second/mask" in hex, # starts comment
+void fuse_load(const char *name)
+{
+	FILE *f;
+	char line[256];
+
+	f = fopen(name, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error: can't open fuse list %s\n", name);
+		exit(0);
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (fuse_count == FUSE_MAX_RULES)
+		{
+			fprintf(stderr, "Error: too many fuse rules in %s\n", name);
+			break;
+		}
+		if (sscanf(line, "%x/%x %x/%x",
+			&fuse_first_value[fuse_count], &fuse_first_mask[fuse_count],
+			&fuse_second_value[fuse_count], &fuse_second_mask[fuse_count]) != 4)
+		{
+			fprintf(stderr, "Error: bad fuse rule: %s", line);
+			continue;
+		}
+		++fuse_count;
+	}
+	fclose(f);
+}
+
+int profile_order(const void *a, const void *b)
+{
+	unsigned long long x = profile_count[*(const int*)a];
+	unsigned long long y = profile_count[*(const int*)b];
+	return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+// each line is "opcode count" as written by m68k_profile_save, opcode in
+// hex, # starts comment
+void profile_load(const char *name)
+{
+	FILE *f;
+	char line[256];
+	int order[0x10000];
+	unsigned long long count, total = 0, sum = 0;
+	int i, opcode;
+
+	f = fopen(name, "r");
+	if (!f)
+	{
+		fprintf(stderr, "Error: can't open profile %s\n", name);
+		exit(0);
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%x %llu", &opcode, &count) != 2 || opcode > 0xFFFF)
+		{
+			fprintf(stderr, "Error: bad profile line: %s", line);
+			continue;
+		}
+		profile_count[opcode] += count;
+		total += count;
+	}
+	fclose(f);
+
+	for (i=0; i<0x10000; ++i)
+		order[i] = i;
+	qsort(order, 0x10000, sizeof(int), profile_order);
+	for (i=0; i<0x10000 && sum < total * (PROFILE_HOT / 100); ++i)
+	{
+		hot[order[i]] = 1;
+		sum += profile_count[order[i]];
+		hot_heat = profile_count[order[i]];
+	}
+	profiled = total > 0;
+}
+
+#define FUSE_DISPATCH 0 // second one goes through handler table
+#define FUSE_BCC 1      // bcc except bsr, inline
+#define FUSE_DBCC 2     // dbcc, inline
+
+// branches are short enough to be inlined for whole pattern, since their
+// fields are decoded at runtime, other patterns may be wide
+int fuse_kind(int rule)
+{
+	int value = fuse_second_value[rule], mask = fuse_second_mask[rule];
+
+	if ((mask & 0xF000) == 0xF000 && (value & 0xF000) == 0x6000
+	 && ((mask & 0x0F00) != 0x0F00 || (value & 0x0F00) != 0x0100))
+		return FUSE_BCC;
+	if ((mask & 0xF0F8) == 0xF0F8 && (value & 0xF0F8) == 0x50C8)
+		return FUSE_DBCC;
+	return FUSE_DISPATCH;
+}
+
+// condition of second opcode, known if mask has it
+void fuse_print_condition(int rule)
+{
+	if ((fuse_second_mask[rule] & 0x0F00) == 0x0F00)
+	{
+		fprintf(out, "CONDITION_%s", cc_up((fuse_second_value[rule]>>8)&0xF));
+		return;
+	}
+	fprintf(out, "fuse_condition(m68k, (opcode>>8)&0xF)");
+}
+
+// emitted once before fused handlers if any of them decodes condition
+void fuse_condition(void)
+{
+	int cc;
+
+	fprintf(out, "static int fuse_condition(m68k_context *m68k, uint32_t cc)\n{\n");
+	fprintf(out, "\tswitch (cc)\n\t{\n");
+	for (cc=0; cc<16; ++cc)
+		fprintf(out, "\t\tcase %d: return CONDITION_%s;\n", cc, cc_up(cc));
+	fprintf(out, "\t}\n\treturn 0;\n}\n\n");
+}
+
+void fuse(int opcode)
+{
+	int i, any = 0, inline_any = 0, dispatch_any = 0;
+
+	if (valid[opcode] == invalid())
+		return;
+
+	for (i=0; i<fuse_count; ++i)
+		if ((opcode & fuse_first_mask[i]) == fuse_first_value[i])
+		{
+			any = 1;
+			if (fuse_kind(i) == FUSE_DISPATCH)
+				dispatch_any = 1;
+			else
+				inline_any = 1;
+		}
+	if (!any)
+		return;
+
+	fused[opcode] = 1;
+	fprintf(out, "M68K_FAST_FUNCTION(fuse_%04X)\n{\n", opcode);
+	fprintf(out, "\tuint32_t cycles, opcode%s%s;\n\n", inline_any ? ", disp" : "", dispatch_any ? ", time, i, length" : "");
+	fprintf(out, "\tif (!(cycles = fast_%s(m68k)))\n\t\treturn 0;\n\n", func_names[valid[opcode]]);
+	fprintf(out, "\topcode = READ_16(PC);\n");
+
+	// branch right after first one runs here without dispatch
+	for (i=0; i<fuse_count; ++i)
+	{
+		int mask = fuse_second_mask[i], value = fuse_second_value[i];
+
+		if ((opcode & fuse_first_mask[i]) != fuse_first_value[i])
+			continue;
+
+		switch (fuse_kind(i))
+		{
+			case FUSE_BCC:
+				fprintf(out, "\tif ((opcode & 0x%04X) == 0x%04X", mask, value);
+				if ((mask & 0x0F00) != 0x0F00)
+					fprintf(out, " && (opcode & 0x0F00) != 0x0100");
+				fprintf(out, ")\n\t{\n");
+				fprintf(out, "\t\tm68k->opcode = opcode;\n");
+				fprintf(out, "\t\tif (m68k->profile)\n\t\t\tm68k_profile_count(m68k);\n");
+				fprintf(out, "\t\tPC += 2;\n");
+				fprintf(out, "\t\tif (opcode & 0xFF)\n");
+				fprintf(out, "\t\t\tdisp = (int8_t)opcode;\n");
+				fprintf(out, "\t\telse\n\t\t{\n");
+				fprintf(out, "\t\t\tcycles += READ_WAIT_TIME;\n");
+				fprintf(out, "\t\t\tdisp = (int16_t)READ_16(PC) - 2;\n");
+				fprintf(out, "\t\t\tPC += 2;\n\t\t}\n");
+				fprintf(out, "\t\tif (");
+				fuse_print_condition(i);
+				fprintf(out, ")\n\t\t\tPC += disp;\n");
+				fprintf(out, "\t\treturn cycles + READ_WAIT_TIME;\n\t}\n");
+				break;
+			case FUSE_DBCC:
+				fprintf(out, "\tif ((opcode & 0x%04X) == 0x%04X)\n\t{\n", mask, value);
+				fprintf(out, "\t\tm68k->opcode = opcode;\n");
+				fprintf(out, "\t\tif (m68k->profile)\n\t\t\tm68k_profile_count(m68k);\n");
+				fprintf(out, "\t\tcycles += READ_WAIT_TIME;\n");
+				fprintf(out, "\t\tdisp = (int16_t)READ_16(PC + 2) - 2;\n");
+				fprintf(out, "\t\tPC += 4;\n");
+				fprintf(out, "\t\tif (!(");
+				fuse_print_condition(i);
+				fprintf(out, "))\n\t\t{\n");
+				if ((mask & 7) == 7)
+				{
+					fprintf(out, "\t\t\tSET_DN_REG16(%d, REG_D(%d)-1);\n", value&7, value&7);
+					fprintf(out, "\t\t\tif ((int16_t)(REG_D(%d)) != -1)\n", value&7);
+				}
+				else
+				{
+					fprintf(out, "\t\t\tSET_DN_REG16(opcode&7, REG_D(opcode&7)-1);\n");
+					fprintf(out, "\t\t\tif ((int16_t)(REG_D(opcode&7)) != -1)\n");
+				}
+				fprintf(out, "\t\t\t\tPC += disp;\n\t\t}\n");
+				fprintf(out, "\t\treturn cycles + READ_WAIT_TIME;\n\t}\n");
+				break;
+		}
+	}
+
+	if (!dispatch_any)
+	{
+		fprintf(out, "\treturn cycles;\n}\n\n");
+		return;
+	}
+
+	fprintf(out, "\tif (");
+	any = 0;
+	for (i=0; i<fuse_count; ++i)
+	{
+		if ((opcode & fuse_first_mask[i]) != fuse_first_value[i]
+		 || fuse_kind(i) != FUSE_DISPATCH)
+			continue;
+		fprintf(out, "%s(opcode & 0x%04X) != 0x%04X", any ? "\n\t && " : "", fuse_second_mask[i], fuse_second_value[i]);
+		any = 1;
+	}
+	fprintf(out, ")\n\t\treturn cycles;\n\n");
+
+	// second one is dispatched as usual, but without leaving the step
+	fprintf(out, "\tlength = m68k_fast_opcode_length[opcode];\n");
+	fprintf(out, "\tfor (i=1; i<length; ++i)\n");
+	fprintf(out, "\t\tm68k->ext_words[i-1] = READ_16(PC + i*2);\n");
+	fprintf(out, "\tm68k->ext = m68k->ext_words;\n");
+	fprintf(out, "\tm68k->opcode = opcode;\n");
+	fprintf(out, "\tif (m68k->profile)\n\t\tm68k_profile_count(m68k);\n");
+	fprintf(out, "\tPC += 2;\n");
+	fprintf(out, "\tif (!(time = M68K_FAST_HANDLER(opcode)(m68k)))\n");
+	fprintf(out, "\t{\n\t\tm68k->timeout += cycles; // next_func is set by handler\n\t\treturn 0;\n\t}\n");
+	fprintf(out, "\treturn cycles + time;\n}\n\n");
+}
+
+// hot handlers and states are put together by compiler, exception and
+// never executed ones apart from them
+const char* func_attribute(int id)
+{
+	// every instruction is fetched by these
+	if (profiled && (!strcmp(func_names[id], "opcode_wait") || !strcmp(func_names[id], "opcode_read")))
+		return "M68K_HOT ";
+	if (cold_state(func_names[id]) || (profiled && !func_heat[id]))
+		return "M68K_COLD ";
+	if (profiled && func_heat[id] >= hot_heat)
+		return "M68K_HOT ";
+	return "";
+}
+
+// opcode to handler is two bytes of index into dense array of unique
+// handlers instead of pointer, so table is small and needs no relocation,
+// negative index is taken from valid
+void print_index(FILE *f, const char *name, const int *index)
+{
+	int i;
+
+	fprintf(f, "const uint16_t %s[0x10000] = {\n", name);
+	for (i=0; i<0x10000; ++i)
+		fprintf(f, "%d,\n", index[i] < 0 ? valid[i] : index[i]);
+	fprintf(f, "};\n\n");
+}
+
+// metadata of m68k.h m68k_opcode_info, opcodes sharing same one share row
+void print_opcode_info(void)
+{
+	FILE *f;
+	int index[0x10000];
+	int row[10];
+	int i, count;
+
+	f = fopen("m68k_opcode_info.c","wb");
+	fprintf(f, "#include \"m68k_opcode.h\"\n\n");
+	fprintf(f, "const m68k_opcode_info m68k_opcode_info_table[] = {\n");
+	for (i=0; i<0x10000; ++i)
+	{
+		memset(row, 0, sizeof(row));
+		row[5] = 3;
+		row[6] = row[7] = -1;
+		if (valid[i] != invalid())
+		{
+			row[0] = opcode_length[i];
+			row[1] = opcode_info[i].bus_words + 1;
+			row[2] = opcode_info[i].delay;
+			row[3] = opcode_info[i].reads;
+			row[4] = opcode_info[i].writes;
+			row[5] = opcode_info[i].size;
+			row[6] = opcode_info[i].ea;
+			row[7] = opcode_info[i].ea_dest;
+			row[8] = ccr_read(i);
+			row[9] = ccr_written(i);
+		}
+
+		count = class_count;
+		index[i] = class_of((char*)row, sizeof(row));
+		if (class_count == count)
+			continue;
+		fprintf(f, "{%d, READ_WAIT_TIME*%d + %d, %d, %d, %d, ", row[0], row[1], row[2], row[3], row[4], row[5]);
+		if (row[6] < 0)
+			fprintf(f, "M68K_EA_NONE, ");
+		else
+			fprintf(f, "%d, ", row[6]);
+		if (row[7] < 0)
+			fprintf(f, "M68K_EA_NONE, ");
+		else
+			fprintf(f, "%d, ", row[7]);
+		fprintf(f, "0x%02X, 0x%02X},\n", row[8], row[9]);
+	}
+	fprintf(f, "};\n\n");
+	class_reset();
+
+	print_index(f, "m68k_opcode_info_index", index);
+	fclose(f);
+}
+
+// abcd and sbcd of 68000 including undocumented N and V, X is carry
+// of decimal result. entry is result, NVC and X, Z if result isn't 0
+int bcd_entry(int sub, int x, int dst, int src)
+{
+	unsigned res, corf = 0, v, c;
+
+	if (sub)
+	{
+		res = (dst & 0xF) - (src & 0xF) - x;
+		if (res > 0xF)
+			corf = 6;
+		res += (dst & 0xF0) - (src & 0xF0);
+		v = res;
+		c = res > 0xFF || res < corf;
+		if (res > 0xFF)
+			res += 0xA0;
+		res = (res - corf) & 0xFF;
+		v &= ~res;
+	}
+	else
+	{
+		res = (src & 0xF) + (dst & 0xF) + x;
+		if (res > 9)
+			corf = 6;
+		res += (src & 0xF0) + (dst & 0xF0);
+		v = ~res;
+		res += corf;
+		c = res > 0x9F;
+		if (c)
+			res -= 0xA0;
+		v &= res;
+		res &= 0xFF;
+	}
+
+	return res | ((c ? CCR_X|CCR_C : 0) | (res & 0x80 ? CCR_N : 0)
+		| (res ? CCR_Z : 0) | (v & 0x80 ? CCR_V : 0)) << 8;
+}
+
+void print_bcd_table(void)
+{
+	FILE *f;
+	int i;
+
+	f = fopen("m68k_bcd_table.c","wb");
+	fprintf(f, "#include \"m68k_opcode.h\"\n\n");
+	fprintf(f, "const uint16_t m68k_bcd_table[2][0x20000] = {\n");
+	for (i=0; i<0x40000; ++i)
+	{
+		if (!(i & 0x1FFFF))
+			fprintf(f, "{\n");
+		fprintf(f, "0x%04X,%s", bcd_entry(i>>17, (i>>16)&1, (i>>8)&0xFF, i&0xFF), (i & 15) == 15 ? "\n" : "");
+		if ((i & 0x1FFFF) == 0x1FFFF)
+			fprintf(f, "},\n");
+	}
+	fprintf(f, "};\n");
+	fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+	FILE *f;
+	const char *rom_name = 0;
+	const char *profile_name = 0;
+
+	// "fast" produces instruction-granular core for m68k->mode == M68K_MODE_FAST
+	if (argc > 1 && !strcmp(argv[1], "fast"))
+		fast_mode = 1;
+
+	// "threaded" produces m68k_threaded_run_until with all states inside
+	if (argc > 1 && !strcmp(argv[1], "threaded"))
+		threaded_mode = 1;
+
+	// "cont" produces cont_* states for m68k_cont_run_until
+	if (argc > 1 && !strcmp(argv[1], "cont"))
+		cont_mode = 1;
+
+	// "fast rom.bin" also translates given ROM into m68k_rec_blocks.c
+	// "fast fuse=list" adds superinstructions for pairs from list
+	// "compact=move,moveq" decodes registers of listed families at runtime,
+	// any core, supported are immediate ones (ori, andi, subi, addi, eori,
+	// cmpi), bit ones (btst, bchg, bclr, bset), unary ones (negx, clr, neg,
+	// not, tst, nbcd), addq, subq, moveq, move, movem, mulu, muls, divu,
+	// divs, abcd, sbcd and shifts (asl, asr, lsl, lsr, roxl, roxr, rol, ror)
+	// "profile=file" keeps hot opcodes of m68k_profile_save output fully
+	// specialized and makes others compact, all families unless compact= is given
+	for (i=1; i<argc; ++i)
+	{
+		if (!strncmp(argv[i], "compact=", 8))
+			compact_families = argv[i] + 8;
+		else if (!strncmp(argv[i], "profile=", 8))
+			profile_name = argv[i] + 8;
+		else if (i > 1 && fast_mode && !strncmp(argv[i], "fuse=", 5))
+			fuse_load(argv[i] + 5);
+		else if (i > 1 && fast_mode)
+			rom_name = argv[i];
+	}
+
+	if (profile_name)
+	{
+		profile_load(profile_name);
+		if (!compact_families)
+			compact_families = "all";
+	}
+
+	hash_init();
+	merge_begin();
+
+	if (fast_mode)
+	{
+		fprintf(out, "#define M68K_FAST\n");
+		fprintf(out, "#include \"m68k_opcode.h\"\n");
+		fprintf(out, "#include \"m68k_fast_optable.h\"\n\n");
+
+		// exceptions are handled by cycle-split core
+		declare_function("invalid");
+	}
+	else
+	{
+		if (threaded_mode)
+		{
+			fprintf(out, "#define M68K_THREADED\n");
+			fprintf(out, "#include \"m68k_opcode.h\"\n");
+			fprintf(out, "#include \"m68k_threaded_table.h\"\n\n");
+
+			fprintf(out, "uint64_t m68k_threaded_run_until(m68k_context *m68k, uint64_t target)\n{\n");
+			fprintf(out, "#include \"m68k_threaded_labels.h\"\n");
+			fprintf(out, "\tuint64_t start = m68k->cycles;\n");
+			fprintf(out, "\tuint64_t cycles = m68k->cycles;\n");
+			fprintf(out, "\tuint32_t timeout = m68k->timeout;\n");
+			fprintf(out, "\tuint32_t state = m68k->state;\n\n");
+			fprintf(out, "\tif (target <= start)\n\t\treturn 0;\n");
+			fprintf(out, "\tif (cycles + timeout > target)\n\t\tgoto leave;\n");
+			fprintf(out, "\tcycles += timeout;\n");
+			fprintf(out, "\tTHREAD_DISPATCH;\n\n");
+		}
+		else if (cont_mode)
+		{
+			fprintf(out, "#define M68K_CONT\n");
+			fprintf(out, "#include \"m68k_opcode.h\"\n");
+			fprintf(out, "#include \"m68k_cont_optable.h\"\n\n");
+		}
+		else
+		{
+			fprintf(out, "#include \"m68k_opcode.h\"\n");
+			fprintf(out, "#include \"m68k_optable.h\"\n\n");
+		}
+
+		// reset_exception must be state 0, see m68k_init
+		reset_exception();
+		address_exception();
+		interrupt();
+		trap_exception();
+
+		// same in every core, m68k_init and m68k_interrupt start them
+		f = fopen("m68k_states.h","wb");
+		fprintf(f, "enum\n{\n");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "\tM68K_STATE_%s,\n", func_names[i]);
+		fprintf(f, "\tM68K_STATE_EXCEPTION_COUNT\n};\n");
+		fclose(f);
+		exception_count = func_count;
+
+		if (threaded_mode)
+		{
+			begin_function("invalid");
+			fprintf(out, "\tinvalid(m68k);\n");
+			fprintf(out, "\tTIMEOUT(1<<20, invalid);\n}\n\n");
+		}
+		else
+			declare_function("invalid");
+
+		done_states();
+		movem_states();
+
+		declare_function("opcode_wait");
+		declare_function("opcode_read");
+	}
+
+	fixed_count = func_count;
+	for (i=0; i<0x10000; ++i)
+	{
+		valid[i] = invalid();
+		opcode_length[i] = 1;
+		gen_opcode(i);
+	}
+
+	if (fast_mode)
+	{
+		flags_dead = 1;
+		for (i=0; i<0x10000; ++i)
+		{
+			valid_nf[i] = -1;
+			if (valid[i] != invalid() && flags_dead_form(i))
+				gen_opcode(i);
+		}
+		flags_dead = 0;
+	}
+
+	merge_functions();
+
+	if (fast_mode)
+	{
+		int count = func_count;
+
+		for (i=0; i<fuse_count; ++i)
+			if (fuse_kind(i) != FUSE_DISPATCH && (fuse_second_mask[i] & 0x0F00) != 0x0F00)
+			{
+				fuse_condition();
+				break;
+			}
+		for (i=0; i<0x10000; ++i)
+		{
+			fuse(i);
+			count += fused[i];
+		}
+		if (count > 0xFFFF)
+			fprintf(stderr, "Error: too many handlers for 16-bit index\n");
+
+		f = fopen("m68k_fast_optable.h","wb");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "%sM68K_FAST_FUNCTION(fast_%s);\n", func_attribute(i), func_names[i]);
+		fprintf(f, "\nextern m68k_fast_function const m68k_fast_handler[];\n");
+		fprintf(f, "extern const uint16_t m68k_fast_opcode_index[0x10000];\n");
+		fprintf(f, "extern const uint8_t m68k_fast_opcode_length[0x10000];\n");
+		fprintf(f, "extern const uint16_t m68k_fast_nf_index[0x10000];\n");
+		fprintf(f, "extern const uint8_t m68k_fast_opcode_flags[0x10000];\n");
+		if (fuse_count)
+			fprintf(f, "extern const uint16_t m68k_fast_fused_index[0x10000];\n");
+		else
+			fprintf(f, "#define m68k_fast_fused_index m68k_fast_opcode_index\n");
+		fprintf(f, "\n#define M68K_FAST_HANDLER(opcode) m68k_fast_handler[m68k_fast_opcode_index[opcode]]\n");
+		fprintf(f, "#define M68K_FAST_NF_HANDLER(opcode) m68k_fast_handler[m68k_fast_nf_index[opcode]]\n");
+		fprintf(f, "#define M68K_FAST_FUSED_HANDLER(opcode) m68k_fast_handler[m68k_fast_fused_index[opcode]]\n");
+		fclose(f);
+
+		f = fopen("m68k_fast_optable.c","wb");
+		fprintf(f, "#include \"m68k_opcode.h\"\n#include \"m68k_fast_optable.h\"\n\n");
+
+		// pairs are fused only when opcodes are fetched one by one
+		for (i=0; i<0x10000; ++i)
+			if (fused[i])
+				fprintf(f, "M68K_FAST_FUNCTION(fuse_%04X);\n", i);
+
+		// fused handlers follow generated ones
+		fprintf(f, "\nm68k_fast_function const m68k_fast_handler[] = {\n");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "fast_%s,\n", func_names[i]);
+		for (i=0; i<0x10000; ++i)
+			if (fused[i])
+				fprintf(f, "fuse_%04X,\n", i);
+		fprintf(f, "};\n\n");
+
+		print_index(f, "m68k_fast_opcode_index", valid);
+
+		// words of instruction, so extension words can be fetched ahead
+		fprintf(f, "const uint8_t m68k_fast_opcode_length[0x10000] = {\n");
+		for (i=0; i<0x10000; ++i)
+		{
+			if (opcode_length[i] > M68K_MAX_EXT_WORDS + 1)
+				fprintf(stderr, "Error: opcode %04X is longer than M68K_MAX_EXT_WORDS\n", i);
+			fprintf(f, "%d,\n", opcode_length[i]);
+		}
+		fprintf(f, "};\n\n");
+
+		// flags-dead handlers, usual one if opcode has none
+		print_index(f, "m68k_fast_nf_index", valid_nf);
+
+		// M68K_FAST_FLAGS_* for flag liveness of block cache
+		fprintf(f, "const uint8_t m68k_fast_opcode_flags[0x10000] = {\n");
+		for (i=0; i<0x10000; ++i)
+			fprintf(f, "%d,\n", opcode_flags(i));
+		fprintf(f, "};\n");
+
+		if (fuse_count)
+		{
+			count = func_count;
+			for (i=0; i<0x10000; ++i)
+				fused[i] = fused[i] ? count++ : -1;
+			fprintf(f, "\n");
+			print_index(f, "m68k_fast_fused_index", fused);
+		}
+		fclose(f);
+
+		print_opcode_info();
+
+		if (rom_name)
+			rec_rom(rom_name);
+		return 0;
+	}
+
+	if (threaded_mode)
+	{
+		fprintf(out, "#ifndef M68K_LABELS_AS_VALUES\n");
+		fprintf(out, "dispatch:\n\tswitch (state)\n\t{\n");
+		for (i=0; i<func_count; ++i)
+			fprintf(out, "\t\tcase M68K_STATE_%s: goto L_%s;\n", func_names[i], func_names[i]);
+		fprintf(out, "\t}\n#endif\n\n");
+
+		fprintf(out, "leave:\n");
+		fprintf(out, "\tFLUSH_FLAGS;\n");
+		fprintf(out, "\tm68k->state = state;\n");
+		fprintf(out, "\tm68k->timeout = timeout - (uint32_t)(target - cycles);\n");
+		fprintf(out, "\tm68k->cycles = target;\n");
+		fprintf(out, "\treturn target - start;\n}\n");
+
+		f = fopen("m68k_threaded_table.h","wb");
+		fprintf(f, "#include \"m68k_states.h\"\n\n");
+		fprintf(f, "enum\n{\n");
+		fprintf(f, "\tM68K_STATE_%s = M68K_STATE_EXCEPTION_COUNT,\n", func_names[exception_count]);
+		for (i=exception_count+1; i<func_count; ++i)
+			fprintf(f, "\tM68K_STATE_%s,\n", func_names[i]);
+		fprintf(f, "\tM68K_STATE_COUNT\n};\n\n");
+		fprintf(f, "static const uint16_t m68k_threaded_opcode_state[0x10000] = {\n");
+		for (i=0; i<0x10000; ++i)
+			fprintf(f, "M68K_STATE_%s,\n", func_names[valid[i]]);
+		fprintf(f, "};\n");
+		fclose(f);
+
+		f = fopen("m68k_threaded_labels.h","wb");
+		fprintf(f, "#ifdef M68K_LABELS_AS_VALUES\n");
+		fprintf(f, "static const void* const state_label[M68K_STATE_COUNT] = {\n");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "&&L_%s,\n", func_names[i]);
+		fprintf(f, "};\n#endif\n");
+		fclose(f);
+		return 0;
+	}
+
+	if (cont_mode)
+	{
+		f = fopen("m68k_cont_optable.h","wb");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "%sM68K_CONT_FUNCTION(cont_%s);\n", func_attribute(i), func_names[i]);
+		fprintf(f, "\nextern m68k_cont_function const m68k_cont_handler[];\n");
+		fprintf(f, "extern const uint16_t m68k_cont_opcode_index[0x10000];\n");
+		fprintf(f, "\n#define M68K_CONT_HANDLER(opcode) m68k_cont_handler[m68k_cont_opcode_index[opcode]]\n");
+		fclose(f);
+
+		f = fopen("m68k_cont_optable.c","wb");
+		fprintf(f, "#include \"m68k_opcode.h\"\n#include \"m68k_cont_optable.h\"\n\nm68k_cont_function const m68k_cont_handler[] = {\n");
+		for (i=0; i<func_count; ++i)
+			fprintf(f, "cont_%s,\n", func_names[i]);
+		fprintf(f, "};\n\n");
+		print_index(f, "m68k_cont_opcode_index", valid);
+
+		// cont_func is 0 after m68k_init and m68k_interrupt, which set state
+		fprintf(f, "\nuint64_t m68k_cont_run_until(m68k_context *m68k, uint64_t target)\n{\n");
+		fprintf(f, "\tuint64_t start = m68k->cycles;\n");
+		fprintf(f, "\tuint64_t cycles = start;\n");
+		fprintf(f, "\tm68k_cont cont;\n\n");
+		fprintf(f, "\tif (target <= start)\n\t\treturn 0;\n\n");
+		fprintf(f, "\t// continuation stays in registers until we leave\n");
+		fprintf(f, "\tcont.next = m68k->cont_func ? m68k->cont_func : m68k_cont_handler[m68k->state];\n");
+		fprintf(f, "\tcont.timeout = m68k->timeout;\n");
+		fprintf(f, "\twhile (cycles + cont.timeout <= target)\n\t{\n");
+		fprintf(f, "\t\tcycles += cont.timeout;\n");
+		fprintf(f, "\t\tcont = cont.next(m68k);\n\t}\n\n");
+		fprintf(f, "\tm68k->cont_func = cont.next;\n");
+		fprintf(f, "\tm68k->timeout = cont.timeout - (uint32_t)(target - cycles);\n");
+		fprintf(f, "\tm68k->cycles = target;\n");
+		fprintf(f, "\tFLUSH_FLAGS;\n");
+		fprintf(f, "\treturn target - start;\n}\n");
+		fclose(f);
+		return 0;
+	}
+
+	if (func_count > 0xFFFF)
+		fprintf(stderr, "Error: too many handlers for 16-bit index\n");
+
+	print_bcd_table();
+
+	f = fopen("m68k_optable.h","wb");
+	for (i=0; i<func_count; ++i)
+		fprintf(f, "%sM68K_FUNCTION(%s);\n", func_attribute(i), func_names[i]);
+	fprintf(f, "\nextern m68k_function const m68k_handler[];\n");
+	fprintf(f, "extern const uint16_t m68k_opcode_index[0x10000];\n");
+	fprintf(f, "\n#define M68K_HANDLER(opcode) m68k_handler[m68k_opcode_index[opcode]]\n");
+	fclose(f);
+
+	f = fopen("m68k_optable.c","wb");
+	fprintf(f, "#include \"m68k_opcode.h\"\n\nm68k_function const m68k_handler[] = {\n");
+	for (i=0; i<func_count; ++i)
+		fprintf(f, "%s,\n", func_names[i]);
+	fprintf(f, "};\n\n");
+	print_index(f, "m68k_opcode_index", valid);
 	fclose(f);
 }